@@ -0,0 +1,116 @@
+#include "PerfCounters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace GBEmu {
+#ifdef __linux__
+	static int openCounter(uint32_t type, uint64_t config)
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		// this thread, any cpu
+		return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+
+	static uint64_t cacheConfig(uint64_t cache, uint64_t op, uint64_t result)
+	{
+		return cache | (op << 8) | (result << 16);
+	}
+#endif
+
+	PerfCounters::PerfCounters()
+	{
+		for (int i = 0; i < PC_COUNT; i++) {
+			fds[i] = -1;
+			values[i] = 0;
+		}
+
+#ifdef __linux__
+		fds[PC_CYCLES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+		fds[PC_INSTRUCTIONS] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+		fds[PC_BRANCH_MISSES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+		fds[PC_L1D_MISSES] = openCounter(PERF_TYPE_HW_CACHE,
+			cacheConfig(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS));
+		fds[PC_LLC_MISSES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+#endif
+	}
+
+	PerfCounters::~PerfCounters()
+	{
+#ifdef __linux__
+		for (int i = 0; i < PC_COUNT; i++) {
+			if (fds[i] >= 0)
+				close(fds[i]);
+		}
+#endif
+	}
+
+	bool PerfCounters::isAvailable(COUNTER c) const
+	{
+		return fds[c] >= 0;
+	}
+
+	bool PerfCounters::anyAvailable() const
+	{
+		for (int i = 0; i < PC_COUNT; i++) {
+			if (fds[i] >= 0)
+				return true;
+		}
+
+		return false;
+	}
+
+	void PerfCounters::start()
+	{
+#ifdef __linux__
+		for (int i = 0; i < PC_COUNT; i++) {
+			if (fds[i] < 0) continue;
+			ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+	}
+
+	void PerfCounters::stop()
+	{
+#ifdef __linux__
+		for (int i = 0; i < PC_COUNT; i++) {
+			if (fds[i] < 0) continue;
+			ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+			// value, time enabled, time running
+			uint64_t buf[3];
+			if (read(fds[i], buf, sizeof(buf)) != sizeof(buf) || !buf[2])
+				values[i] = 0;
+			else if (buf[2] < buf[1])
+				values[i] = uint64_t(double(buf[0]) * buf[1] / buf[2]);
+			else
+				values[i] = buf[0];
+		}
+#endif
+	}
+
+	uint64_t PerfCounters::get(COUNTER c) const
+	{
+		return fds[c] >= 0 ? values[c] : 0;
+	}
+
+	const char* PerfCounters::getName(COUNTER c)
+	{
+		static const char* names[PC_COUNT] = { "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses" };
+		return names[c];
+	}
+}
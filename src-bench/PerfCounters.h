@@ -0,0 +1,44 @@
+#pragma once
+
+#include "types.h"
+
+namespace GBEmu {
+	// hardware counters of the calling thread, through perf_event_open.
+	// anything the kernel won't give us (not linux, containers, paranoid
+	// settings) is just reported as unavailable.
+	class PerfCounters {
+	public:
+		enum COUNTER {
+			PC_CYCLES,
+			PC_INSTRUCTIONS,
+			PC_BRANCH_MISSES,
+			PC_L1D_MISSES, // reads
+			PC_LLC_MISSES,
+			PC_COUNT
+		};
+
+		PerfCounters();
+		~PerfCounters();
+
+		PerfCounters(const PerfCounters&) = delete;
+		PerfCounters& operator=(const PerfCounters&) = delete;
+
+		bool isAvailable(COUNTER c) const;
+		bool anyAvailable() const;
+
+		// zero and start counting
+		void start();
+		void stop();
+
+		// counted between the last start() and stop(). 0 if unavailable.
+		// when the pmu had to share counters between events, this is
+		// scaled up from the time the counter actually ran.
+		uint64_t get(COUNTER c) const;
+
+		static const char* getName(COUNTER c);
+
+	private:
+		int fds[PC_COUNT];
+		uint64_t values[PC_COUNT];
+	};
+}
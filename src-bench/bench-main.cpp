@@ -0,0 +1,419 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include "Z80.h"
+#include "Video.h"
+#include "PerfCounters.h"
+
+// whole-system benchmark. each rom is run for a fixed amount of emulated time
+// (frames of FRAME_CYCLES, whether the lcd is on or not) with nothing shown,
+// a few times over from power on.
+//
+// usage: gbemu-bench [options] [rom files...]
+//   --frames N        emulated frames per run (default 600)
+//   --warmup N        runs thrown away before measuring (default 1)
+//   --reps N          measured runs (default 5)
+//   --json FILE       also write the results as json
+//   --no-synthetic    leave out the built-in stress roms
+//   --perf            read hardware counters around the emulation loop
+// with no rom files, the repo's gbemu/t.gb is used if it can be found: in
+// the working directory, under gbemu/ there, or next to the executable's
+// build directory.
+
+namespace {
+	using GBEmu::PerfCounters;
+
+	struct BenchROM {
+		std::string name;
+		vbyte image;
+	};
+
+	// a 32k rom-only cart that jumps to code at 0x150. the bios is skipped,
+	// so there's no logo or checksum to get right.
+	vbyte makeROM(const vbyte& code)
+	{
+		vbyte rom(kB(32), 0);
+
+		const byte entry[] = { 0x00, 0xC3, 0x50, 0x01 }; // nop, jp 0x150
+		memcpy(&rom[0x100], entry, sizeof(entry));
+		memcpy(&rom[0x134], "GBEMUBENCH", 10);
+
+		std::copy(code.begin(), code.end(), rom.begin() + 0x150);
+		return rom;
+	}
+
+	// alu and flag work, no memory traffic. lcd off.
+	vbyte makeALUROM()
+	{
+		return makeROM({
+			0x3E, 0x00,       // 0150 ld a, 0
+			0xE0, 0x40,       // 0152 ldh (40), a
+			0x3E, 0x12,       // 0154 ld a, 12
+			0x06, 0x34,       // 0156 ld b, 34
+			0x0E, 0x56,       // 0158 ld c, 56
+			0x80,             // 015A add a, b     <- loop
+			0x89,             // 015B adc a, c
+			0x92,             // 015C sub d
+			0xAB,             // 015D xor e
+			0xA4,             // 015E and h
+			0xB5,             // 015F or l
+			0x04,             // 0160 inc b
+			0x0D,             // 0161 dec c
+			0x07,             // 0162 rlca
+			0x2F,             // 0163 cpl
+			0x27,             // 0164 daa
+			0x19,             // 0165 add hl, de
+			0x13,             // 0166 inc de
+			0xCB, 0x37,       // 0167 swap a
+			0xCB, 0x11,       // 0169 rl c
+			0xB8,             // 016B cp b
+			0xC3, 0x5A, 0x01  // 016C jp loop
+		});
+	}
+
+	// loads, stores and the stack over work ram. lcd off.
+	vbyte makeMemROM()
+	{
+		return makeROM({
+			0x3E, 0x00,       // 0150 ld a, 0
+			0xE0, 0x40,       // 0152 ldh (40), a
+			0x21, 0x00, 0xC0, // 0154 ld hl, c000  <- start
+			0x7E,             // 0157 ld a, (hl)   <- loop
+			0x3C,             // 0158 inc a
+			0x22,             // 0159 ldi (hl), a
+			0xE5,             // 015A push hl
+			0xD1,             // 015B pop de
+			0x1A,             // 015C ld a, (de)
+			0x12,             // 015D ld (de), a
+			0x7C,             // 015E ld a, h
+			0xFE, 0xD0,       // 015F cp d0
+			0x20, 0xF4,       // 0161 jr nz, loop
+			0x18, 0xEF        // 0163 jr start
+		});
+	}
+
+	// lcd on, tile data and scroll rewritten all the time, so the video
+	// has to sync and redraw constantly.
+	vbyte makePPUROM()
+	{
+		return makeROM({
+			0x21, 0x00, 0x80, // 0150 ld hl, 8000  <- start
+			0x7D,             // 0153 ld a, l      <- loop
+			0x22,             // 0154 ldi (hl), a
+			0xE0, 0x43,       // 0155 ldh (43), a
+			0x7C,             // 0157 ld a, h
+			0xFE, 0x98,       // 0158 cp 98
+			0x20, 0xF7,       // 015A jr nz, loop
+			0x18, 0xF2        // 015C jr start
+		});
+	}
+
+	vbyte loadFile(const std::string& filename)
+	{
+		std::ifstream in(filename, std::ios::in | std::ios::binary);
+		if (!in.is_open())
+			throw std::runtime_error("rom file " + filename + " could not be opened");
+
+		return vbyte(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+
+	// t.gb from the working directory, the repo root, or a build directory
+	// next to gbemu/. empty if it's nowhere.
+	std::string findDefaultROM(const std::string& exe)
+	{
+		size_t slash = exe.find_last_of("/\\");
+		std::string exeDir = slash == std::string::npos ? "" : exe.substr(0, slash + 1);
+
+		const std::string candidates[] = { "t.gb", "gbemu/t.gb", exeDir + "../gbemu/t.gb", exeDir + "../../gbemu/t.gb" };
+		for (auto &path : candidates) {
+			if (std::ifstream(path).good())
+				return path;
+		}
+		return "";
+	}
+
+	struct RunResult {
+		double seconds;
+		uint64_t instructions;
+		uint64_t cycles;
+		uint64_t frames; // drawn by the video, not the budget
+		double emulated; // seconds
+		uint64_t counters[PerfCounters::PC_COUNT];
+	};
+
+	RunResult runOnce(const vbyte& image, uint64_t frames, PerfCounters* perf)
+	{
+		GBEmu::ROM rom;
+		rom.loadfrombuffer(image);
+
+		// a few hundred k of state, keep it off the stack
+		std::unique_ptr<GBEmu::Z80> cpu(new GBEmu::Z80());
+		std::unique_ptr<GBEmu::Video> vid(new GBEmu::Video(cpu.get()));
+		cpu->mmu.assignrom(&rom);
+		cpu->skipBIOS();
+
+		RunResult res = { 0, 0, 0, 0, 0, { 0 } };
+		vid->addVBlankHook([&]() { res.frames++; });
+
+		uint64_t budget = frames * GBEmu::FRAME_CYCLES;
+
+		if (perf)
+			perf->start();
+		auto start = std::chrono::steady_clock::now();
+
+		while (res.cycles < budget) {
+			uint32_t before = cpu->clock.machine;
+			cpu->step();
+			res.cycles += uint32_t(cpu->clock.machine - before);
+			res.instructions++;
+
+			if (vid->due())
+				vid->sync();
+			cpu->executeinterrupts();
+		}
+
+		res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		if (perf) {
+			perf->stop();
+			for (int i = 0; i < PerfCounters::PC_COUNT; i++)
+				res.counters[i] = perf->get(PerfCounters::COUNTER(i));
+		}
+
+		res.emulated = res.cycles * cpu->msPerCycle() / 1000.0;
+		return res;
+	}
+
+	struct Summary {
+		std::string name;
+		uint64_t frames;
+		uint64_t instructions;
+		uint64_t cycles;
+		uint64_t framesDrawn;
+
+		// over the measured runs
+		double nsPerFrameMean, nsPerFrameStddev, nsPerFrameMin;
+		double fps, mips, realtime;
+
+		// host events, averaged over the measured runs. < 0 if not counted.
+		double perInstruction[PerfCounters::PC_COUNT];
+		double perFrame[PerfCounters::PC_COUNT];
+	};
+
+	Summary runBench(const BenchROM& rom, uint64_t frames, int warmup, int reps, PerfCounters* perf)
+	{
+		for (int i = 0; i < warmup; i++)
+			runOnce(rom.image, frames, nullptr);
+
+		vector<RunResult> runs;
+		for (int i = 0; i < reps; i++)
+			runs.push_back(runOnce(rom.image, frames, perf));
+
+		Summary s;
+		s.name = rom.name;
+		s.frames = frames;
+		s.instructions = runs[0].instructions;
+		s.cycles = runs[0].cycles;
+		s.framesDrawn = runs[0].frames;
+
+		double sum = 0, best = runs[0].seconds;
+		for (auto &r : runs) {
+			sum += r.seconds;
+			best = std::min(best, r.seconds);
+		}
+
+		double mean = sum / reps;
+		double var = 0;
+		for (auto &r : runs)
+			var += (r.seconds - mean) * (r.seconds - mean);
+		var = reps > 1 ? var / (reps - 1) : 0;
+
+		s.nsPerFrameMean = mean * 1e9 / frames;
+		s.nsPerFrameStddev = std::sqrt(var) * 1e9 / frames;
+		s.nsPerFrameMin = best * 1e9 / frames;
+		s.fps = frames / mean;
+		s.mips = s.instructions / mean / 1e6;
+		s.realtime = runs[0].emulated / mean;
+
+		for (int c = 0; c < PerfCounters::PC_COUNT; c++) {
+			s.perInstruction[c] = s.perFrame[c] = -1;
+			if (!perf || !perf->isAvailable(PerfCounters::COUNTER(c)))
+				continue;
+
+			double total = 0;
+			for (auto &r : runs)
+				total += r.counters[c];
+
+			s.perInstruction[c] = total / (double(s.instructions) * reps);
+			s.perFrame[c] = total / (double(frames) * reps);
+		}
+
+		return s;
+	}
+
+	std::string jsonString(const std::string& str)
+	{
+		std::string out = "\"";
+		for (char c : str) {
+			if (c == '"' || c == '\\')
+				out += '\\';
+			out += c;
+		}
+		return out + "\"";
+	}
+
+	void writeJSON(const std::string& filename, const vector<Summary>& results, int warmup, int reps)
+	{
+		std::ofstream out(filename);
+		if (!out.is_open())
+			throw std::runtime_error("could not write " + filename);
+
+		out.precision(6);
+		out << "{\n";
+		out << "  \"warmup\": " << warmup << ",\n";
+		out << "  \"repetitions\": " << reps << ",\n";
+		out << "  \"results\": [\n";
+
+		for (size_t i = 0; i < results.size(); i++) {
+			auto &s = results[i];
+			out << "    {\n";
+			out << "      \"name\": " << jsonString(s.name) << ",\n";
+			out << "      \"frames\": " << s.frames << ",\n";
+			out << "      \"frames_drawn\": " << s.framesDrawn << ",\n";
+			out << "      \"instructions\": " << s.instructions << ",\n";
+			out << "      \"cycles\": " << s.cycles << ",\n";
+			out << "      \"ns_per_frame\": { \"mean\": " << s.nsPerFrameMean
+				<< ", \"stddev\": " << s.nsPerFrameStddev
+				<< ", \"min\": " << s.nsPerFrameMin << " },\n";
+			out << "      \"fps\": " << s.fps << ",\n";
+			out << "      \"mips\": " << s.mips << ",\n";
+			out << "      \"realtime\": " << s.realtime;
+
+			bool first = true;
+			for (int c = 0; c < PerfCounters::PC_COUNT; c++) {
+				if (s.perInstruction[c] < 0)
+					continue;
+
+				out << (first ? ",\n      \"perf\": {\n" : ",\n");
+				out << "        \"" << PerfCounters::getName(PerfCounters::COUNTER(c)) << "\": { \"per_instruction\": "
+					<< s.perInstruction[c] << ", \"per_frame\": " << s.perFrame[c] << " }";
+				first = false;
+			}
+
+			out << (first ? "\n" : "\n      }\n");
+			out << "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+		}
+
+		out << "  ]\n";
+		out << "}\n";
+	}
+}
+
+int main(int argc, char** argv)
+{
+	uint64_t frames = 600;
+	int warmup = 1, reps = 5;
+	bool synthetic = true, counters = false;
+	std::string json;
+	vector<std::string> files;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "--frames" && hasValue)
+			frames = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--warmup" && hasValue)
+			warmup = atoi(argv[++i]);
+		else if (arg == "--reps" && hasValue)
+			reps = atoi(argv[++i]);
+		else if (arg == "--json" && hasValue)
+			json = argv[++i];
+		else if (arg == "--no-synthetic")
+			synthetic = false;
+		else if (arg == "--perf")
+			counters = true;
+		else if (arg[0] != '-')
+			files.push_back(arg);
+		else {
+			std::cerr << "unknown option " << arg << ", see bench-main.cpp" << std::endl;
+			return 1;
+		}
+	}
+
+	if (!frames || reps < 1) {
+		std::cerr << "need at least one frame and one repetition" << std::endl;
+		return 1;
+	}
+
+	try {
+		vector<BenchROM> roms;
+		if (synthetic) {
+			roms.push_back(BenchROM{ "synthetic-alu", makeALUROM() });
+			roms.push_back(BenchROM{ "synthetic-mem", makeMemROM() });
+			roms.push_back(BenchROM{ "synthetic-ppu", makePPUROM() });
+		}
+
+		if (files.empty()) {
+			std::string found = findDefaultROM(argv[0]);
+			if (!found.empty())
+				files.push_back(found);
+		}
+
+		for (auto &f : files)
+			roms.push_back(BenchROM{ f, loadFile(f) });
+
+		std::unique_ptr<PerfCounters> perf;
+		if (counters) {
+			perf.reset(new PerfCounters());
+			if (!perf->anyAvailable()) {
+				printf("perf counters unavailable, carrying on without them\n");
+				perf.reset();
+			}
+		}
+
+		vector<Summary> results;
+
+		printf("%-20s %10s %10s %12s %10s %9s\n", "rom", "mips", "fps", "ns/frame", "stddev", "realtime");
+		for (auto &rom : roms) {
+			Summary s = runBench(rom, frames, warmup, reps, perf.get());
+			printf("%-20s %10.2f %10.1f %12.0f %9.1f%% %8.1fx\n", s.name.c_str(), s.mips, s.fps,
+				s.nsPerFrameMean, 100 * s.nsPerFrameStddev / s.nsPerFrameMean, s.realtime);
+			results.push_back(s);
+		}
+
+		if (perf) {
+			printf("\nhost events per emulated instruction / per frame\n");
+			printf("%-20s", "rom");
+			for (int c = 0; c < PerfCounters::PC_COUNT; c++) {
+				if (perf->isAvailable(PerfCounters::COUNTER(c)))
+					printf(" %24s", PerfCounters::getName(PerfCounters::COUNTER(c)));
+			}
+			printf("\n");
+
+			for (auto &s : results) {
+				printf("%-20s", s.name.c_str());
+				for (int c = 0; c < PerfCounters::PC_COUNT; c++) {
+					if (s.perInstruction[c] >= 0)
+						printf(" %10.2f / %11.0f", s.perInstruction[c], s.perFrame[c]);
+				}
+				printf("\n");
+			}
+		}
+
+		if (!json.empty())
+			writeJSON(json, results, warmup, reps);
+	}
+	catch (std::exception& e) {
+		std::cerr << "error: " << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
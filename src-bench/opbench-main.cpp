@@ -0,0 +1,208 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include "Z80.h"
+#include "PerfCounters.h"
+
+// times each handler in ops[] and optable2[] on its own, called straight
+// through the table the way runopcode() does, from the same register and
+// memory state every time.
+//
+// usage: gbemu-opbench [options]
+//   --iters N         calls per measurement (default 200000)
+//   --reps N          measurements per handler, the fastest is kept (default 5)
+//   --threshold X     flag handlers over X times the median (default 4)
+//   --sort            slowest first instead of by opcode
+//
+// the cost of putting the fixture back and of the indirect call is measured
+// with an empty handler and taken out. host instructions are only shown
+// when perf counters are available.
+
+namespace {
+	using GBEmu::Z80;
+
+	// everything a handler can touch points into work ram, so loads and stores
+	// stay off the io hooks and the mbc. pc is in wram too, where the operand
+	// bytes 0x80 0xC0 make n/nn forms read or write 0xC080 or 0xFF80.
+	const word FIXTURE_PC = 0xC800;
+	const word FIXTURE_SP = 0xDFF0;
+
+	struct Fixture {
+		byte a, b, c, d, e, h, l, f;
+		word pc, sp;
+	};
+
+	const Fixture fixture = { 0x3C, 0xC2, 0x34, 0xC3, 0x78, 0xC1, 0x00, 0x00, FIXTURE_PC, FIXTURE_SP };
+
+	void setup(Z80& cpu)
+	{
+		cpu.mmu.cleanBIOS();
+
+		for (word addr = 0xC000; addr < 0xE000; addr += 2) {
+			cpu.mmu.rawwriteb(addr, 0x80);
+			cpu.mmu.rawwriteb(addr + 1, 0xC0);
+		}
+	}
+
+	inline void restore(Z80& cpu)
+	{
+		cpu.a = fixture.a;
+		cpu.b = fixture.b;
+		cpu.c = fixture.c;
+		cpu.d = fixture.d;
+		cpu.e = fixture.e;
+		cpu.h = fixture.h;
+		cpu.l = fixture.l;
+		cpu.f = fixture.f;
+		cpu.pc = fixture.pc;
+		cpu.sp = fixture.sp;
+		cpu.halted = false;
+		cpu.stopped = false;
+	}
+
+	byte emptyOp(Z80*)
+	{
+		return 0;
+	}
+
+	struct Timing {
+		double ns; // per call
+		double hostInstructions; // per call, < 0 without counters
+	};
+
+	Timing measure(Z80& cpu, GBEmu::PerfCounters& perf, byte(*volatile op)(Z80*), int iters, int reps)
+	{
+		Timing best = { 1e30, -1 };
+		bool counting = perf.isAvailable(GBEmu::PerfCounters::PC_INSTRUCTIONS);
+
+		for (int r = 0; r < reps; r++) {
+			auto handler = op;
+			uint32_t sink = 0;
+
+			perf.start();
+			auto start = std::chrono::steady_clock::now();
+
+			for (int i = 0; i < iters; i++) {
+				restore(cpu);
+				sink += handler(&cpu);
+			}
+
+			auto end = std::chrono::steady_clock::now();
+			perf.stop();
+
+			cpu.clock.machine += sink; // keep the calls from going anywhere
+
+			double ns = std::chrono::duration<double, std::nano>(end - start).count() / iters;
+			if (ns < best.ns) {
+				best.ns = ns;
+				if (counting)
+					best.hostInstructions = double(perf.get(GBEmu::PerfCounters::PC_INSTRUCTIONS)) / iters;
+			}
+		}
+
+		return best;
+	}
+
+	struct OpResult {
+		std::string name;
+		std::string desc;
+		Timing t;
+	};
+}
+
+int main(int argc, char** argv)
+{
+	int iters = 200000, reps = 5;
+	double threshold = 4;
+	bool sorted = false;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "--iters" && hasValue)
+			iters = atoi(argv[++i]);
+		else if (arg == "--reps" && hasValue)
+			reps = atoi(argv[++i]);
+		else if (arg == "--threshold" && hasValue)
+			threshold = atof(argv[++i]);
+		else if (arg == "--sort")
+			sorted = true;
+		else {
+			std::cerr << "unknown option " << arg << ", see opbench-main.cpp" << std::endl;
+			return 1;
+		}
+	}
+
+	if (iters < 1 || reps < 1) {
+		std::cerr << "need at least one iteration and one repetition" << std::endl;
+		return 1;
+	}
+
+	// a few hundred k of state, keep it off the stack
+	std::unique_ptr<Z80> cpu(new Z80());
+	GBEmu::PerfCounters perf;
+	setup(*cpu);
+
+	Timing base = measure(*cpu, perf, emptyOp, iters, reps);
+
+	vector<OpResult> results;
+	auto run = [&](Z80::z80op* table, const char* prefix) {
+		for (int op = 0; op < 256; op++) {
+			if (!table[op].op || table[op].op == GBEmu::ILLOP)
+				continue;
+			// the prefix only dispatches into optable2, which is timed on its own
+			if (table == GBEmu::ops && op == 0xCB)
+				continue;
+
+			char name[8];
+			sprintf(name, "%s%02X", prefix, op);
+
+			Timing t = measure(*cpu, perf, table[op].op, iters, reps);
+			t.ns = std::max(0.0, t.ns - base.ns);
+			if (t.hostInstructions >= 0)
+				t.hostInstructions = std::max(0.0, t.hostInstructions - base.hostInstructions);
+
+			results.push_back(OpResult{ name, table[op].desc, t });
+		}
+	};
+
+	run(GBEmu::ops, "");
+	run(GBEmu::optable2, "CB");
+
+	vector<double> times;
+	for (auto &r : results)
+		times.push_back(r.t.ns);
+	std::sort(times.begin(), times.end());
+	double median = times[times.size() / 2];
+
+	if (sorted) {
+		std::stable_sort(results.begin(), results.end(), [](const OpResult& a, const OpResult& b) {
+			return a.t.ns > b.t.ns;
+		});
+	}
+
+	printf("%d handlers, median %.2fns, fixture overhead %.2fns taken out\n", (int)results.size(), median, base.ns);
+	if (!perf.anyAvailable())
+		printf("perf counters unavailable, no host instruction counts\n");
+
+	printf("%-6s %-18s %9s %11s\n", "op", "handler", "ns", "host ins");
+
+	int flagged = 0;
+	for (auto &r : results) {
+		bool slow = r.t.ns > median * threshold;
+		flagged += slow;
+
+		char ins[16] = "-";
+		if (r.t.hostInstructions >= 0)
+			sprintf(ins, "%.1f", r.t.hostInstructions);
+
+		printf("%-6s %-18s %9.2f %11s%s\n", r.name.c_str(), r.desc.c_str(), r.t.ns, ins, slow ? "  << slow" : "");
+	}
+
+	printf("%d handlers over %.1fx the median\n", flagged, threshold);
+	return 0;
+}
@@ -0,0 +1,563 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include "Z80.h"
+#include "Video.h"
+#include "Joypad.h"
+#include "HostTrace.h"
+#include "Disassembler.h"
+#include "SaveState.h"
+
+// runs a rom with no window, as fast as it goes.
+//
+// input scripts have one "<frame> <buttons>" per line. from that frame on,
+// the listed buttons (comma separated, or "-" for none) are the ones held.
+// lines starting with # are ignored. e.g.
+//   # press start for a bit at about 2 seconds in
+//   120 start
+//   130 -
+//   200 a,right
+
+struct InputEvent {
+	uint64_t frame;
+	byte buttons;
+};
+
+struct Options {
+	std::string rom;
+	uint64_t frames;
+	uint64_t cycles;
+	bool skipBIOS;
+	vector<InputEvent> input;
+	vector<uint64_t> dumpFrames;
+	uint64_t dumpEvery;
+	std::string dumpPrefix;
+	std::string dumpRAM;
+	std::string loadState, saveState;
+	std::string trace;
+	std::string profile, profileFolded;
+	std::string callgraph;
+	size_t callgraphTop;
+	std::string execTrace, decodeTrace;
+	size_t execTraceSize, execTraceAfter;
+	uint32_t execTraceEvery;
+	std::string execTraceAt;
+	vector<std::string> symFiles;
+	vector<std::string> breaks;
+	std::string disassembly, indexCache;
+	std::string coverage, coverageReport, mergeCoverage;
+	vector<std::string> coverageInputs;
+	bool quiet;
+	bool stats;
+};
+
+static void usage()
+{
+	std::cerr <<
+		"usage: gbemu-headless <rom> [options]\n"
+		"       gbemu-headless --decode-trace FILE [--sym FILE]\n"
+		"       gbemu-headless --merge-coverage OUT FILE... [--coverage-report FILE]\n"
+		"  --frames N        stop after N frames (a frame's worth of cycles\n"
+		"                    counts as one while the lcd is off)\n"
+		"  --cycles N        stop after N cpu cycles\n"
+		"                    (with neither, 600 frames are run)\n"
+		"  --skip-bios       start at 0x100 as if the bios had run\n"
+		"  --input FILE      input script, see headless-main.cpp\n"
+		"  --dump-frame N    write frame N as a pgm (can be repeated)\n"
+		"  --dump-every N    write every Nth frame as a pgm\n"
+		"  --dump-prefix P   pgm files are named P<frame>.pgm (default \"frame\")\n"
+		"  --dump-ram FILE   write the 64k address space to FILE at the end\n"
+		"  --load-state FILE start from a save state instead of from power on\n"
+		"  --save-state FILE write a save state at the end\n"
+		"  --quiet           only print the final state hash\n"
+		"  --stats           print the runtime counters at the end\n"
+		"  --trace FILE      write a chrome trace of where the host time went\n"
+		"  --profile FILE    write a flat profile of where the emulated cycles went\n"
+		"  --profile-folded FILE\n"
+		"                    same, as folded stacks for flamegraphs\n"
+		"  --callgraph FILE  write a callgrind profile of cycles by call stack\n"
+		"  --callgraph-top N print the N functions with the most cycles, calls included\n"
+		"  --exec-trace FILE write the last instructions run as a binary trace\n"
+		"  --exec-trace-size N\n"
+		"                    instructions the trace holds (default 1048576)\n"
+		"  --exec-trace-every N\n"
+		"                    only record every Nth instruction\n"
+		"  --exec-trace-at [BANK:]ADDR\n"
+		"                    stop tracing a while after pc gets to ADDR (hex, or a label)\n"
+		"  --exec-trace-after N\n"
+		"                    instructions recorded past that (default half the size)\n"
+		"  --break SPEC      stop at \"[BANK:]ADDR [if CONDITION]\" or \"LABEL [if ...]\",\n"
+		"                    see Breakpoints.h (can be repeated)\n"
+		"  --disassemble FILE\n"
+		"                    write a listing of the code found in the rom and exit\n"
+		"  --index-cache DIR keep the rom's code index in DIR between runs\n"
+		"  --coverage FILE   write which rom and ram bytes were run, read and written\n"
+		"  --coverage-report FILE\n"
+		"                    the same as text, per bank and as address ranges\n"
+		"  --merge-coverage OUT\n"
+		"                    or the coverage files given together into OUT and exit\n"
+		"  --decode-trace FILE\n"
+		"                    print a binary trace as text and exit\n"
+		"  --sym FILE        rgbds .sym file for naming code and for breakpoints\n"
+		"                    (can be repeated)\n";
+}
+
+static void loadInput(const std::string& filename, vector<InputEvent>& out)
+{
+	std::ifstream in(filename);
+	if (!in.is_open())
+		throw std::runtime_error("input script " + filename + " could not be opened");
+
+	std::string line;
+	int lineno = 0;
+	while (std::getline(in, line)) {
+		lineno++;
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		std::stringstream ss(line);
+		InputEvent evt;
+		std::string buttons;
+		if (!(ss >> evt.frame >> buttons))
+			throw std::runtime_error("input script line " + std::to_string(lineno) + " is malformed");
+
+		evt.buttons = 0;
+		if (buttons != "-") {
+			std::stringstream bs(buttons);
+			std::string name;
+			while (std::getline(bs, name, ',')) {
+				byte btn = GBEmu::getButtonByName(name);
+				if (!btn)
+					throw std::runtime_error("unknown button \"" + name + "\" on input script line " + std::to_string(lineno));
+				evt.buttons |= btn;
+			}
+		}
+
+		out.push_back(evt);
+	}
+
+	std::stable_sort(out.begin(), out.end(), [](const InputEvent& a, const InputEvent& b) {
+		return a.frame < b.frame;
+	});
+}
+
+static bool parseArgs(int argc, char** argv, Options& opt)
+{
+	opt.frames = 0;
+	opt.cycles = 0;
+	opt.skipBIOS = false;
+	opt.dumpEvery = 0;
+	opt.dumpPrefix = "frame";
+	opt.quiet = false;
+	opt.stats = false;
+	opt.callgraphTop = 0;
+	opt.execTraceSize = 1 << 20;
+	opt.execTraceAfter = 0;
+	opt.execTraceEvery = 1;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "--skip-bios")
+			opt.skipBIOS = true;
+		else if (arg == "--quiet")
+			opt.quiet = true;
+		else if (arg == "--stats")
+			opt.stats = true;
+		else if (arg == "--frames" && hasValue)
+			opt.frames = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--cycles" && hasValue)
+			opt.cycles = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--input" && hasValue)
+			loadInput(argv[++i], opt.input);
+		else if (arg == "--dump-frame" && hasValue)
+			opt.dumpFrames.push_back(strtoull(argv[++i], nullptr, 10));
+		else if (arg == "--dump-every" && hasValue)
+			opt.dumpEvery = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--dump-prefix" && hasValue)
+			opt.dumpPrefix = argv[++i];
+		else if (arg == "--trace" && hasValue)
+			opt.trace = argv[++i];
+		else if (arg == "--profile" && hasValue)
+			opt.profile = argv[++i];
+		else if (arg == "--profile-folded" && hasValue)
+			opt.profileFolded = argv[++i];
+		else if (arg == "--callgraph" && hasValue)
+			opt.callgraph = argv[++i];
+		else if (arg == "--callgraph-top" && hasValue)
+			opt.callgraphTop = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--exec-trace" && hasValue)
+			opt.execTrace = argv[++i];
+		else if (arg == "--exec-trace-size" && hasValue)
+			opt.execTraceSize = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--exec-trace-every" && hasValue)
+			opt.execTraceEvery = strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--exec-trace-after" && hasValue)
+			opt.execTraceAfter = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--exec-trace-at" && hasValue)
+			opt.execTraceAt = argv[++i];
+		else if (arg == "--break" && hasValue)
+			opt.breaks.push_back(argv[++i]);
+		else if (arg == "--disassemble" && hasValue)
+			opt.disassembly = argv[++i];
+		else if (arg == "--index-cache" && hasValue)
+			opt.indexCache = argv[++i];
+		else if (arg == "--coverage" && hasValue)
+			opt.coverage = argv[++i];
+		else if (arg == "--coverage-report" && hasValue)
+			opt.coverageReport = argv[++i];
+		else if (arg == "--merge-coverage" && hasValue)
+			opt.mergeCoverage = argv[++i];
+		else if (arg == "--decode-trace" && hasValue)
+			opt.decodeTrace = argv[++i];
+		else if (arg == "--sym" && hasValue)
+			opt.symFiles.push_back(argv[++i]);
+		else if (arg == "--dump-ram" && hasValue)
+			opt.dumpRAM = argv[++i];
+		else if (arg == "--load-state" && hasValue)
+			opt.loadState = argv[++i];
+		else if (arg == "--save-state" && hasValue)
+			opt.saveState = argv[++i];
+		else if (arg[0] != '-')
+			opt.coverageInputs.push_back(arg);
+		else
+			return false;
+	}
+
+	// when merging, the rest are coverage files, otherwise there's just the rom
+	if (opt.mergeCoverage.empty()) {
+		if (opt.coverageInputs.size() > 1)
+			return false;
+		if (!opt.coverageInputs.empty())
+			opt.rom = opt.coverageInputs[0];
+		opt.coverageInputs.clear();
+	}
+
+	if (!opt.frames && !opt.cycles)
+		opt.frames = 600;
+
+	if (!opt.execTraceAfter)
+		opt.execTraceAfter = opt.execTraceSize / 2;
+
+	return !opt.rom.empty() || !opt.decodeTrace.empty() || !opt.coverageInputs.empty();
+}
+
+static bool wantsDump(const Options& opt, uint64_t frame)
+{
+	if (opt.dumpEvery && frame % opt.dumpEvery == 0)
+		return true;
+
+	for (auto f : opt.dumpFrames) {
+		if (f == frame)
+			return true;
+	}
+
+	return false;
+}
+
+static void writePGM(const std::string& filename, const byte* grey)
+{
+	TRACE_SCOPE("dump frame");
+
+	std::ofstream out(filename, std::ios::out | std::ios::binary);
+	if (!out.is_open())
+		throw std::runtime_error("could not write " + filename);
+
+	out << "P5\n" << GBEmu::CANVAS_WIDTH << " " << GBEmu::CANVAS_HEIGHT << "\n255\n";
+	out.write((const char*)grey, GBEmu::CANVAS_SIZE);
+}
+
+static void writeCoverageReport(const std::string& filename, const GBEmu::Coverage& coverage)
+{
+	std::ofstream out(filename);
+	if (!out.is_open())
+		throw std::runtime_error("could not write " + filename);
+	coverage.exportText(out, true);
+}
+
+static void fnv(uint64_t &h, byte b)
+{
+	h ^= b;
+	h *= 1099511628211ull;
+}
+
+// registers and the whole address space as the cpu sees it, so two runs
+// can be compared with one number.
+static uint64_t hashState(GBEmu::Z80& cpu)
+{
+	uint64_t h = 14695981039346656037ull;
+
+	byte regs[] = {
+		cpu.a, cpu.b, cpu.c, cpu.d, cpu.e, cpu.h, cpu.l, cpu.f,
+		byte(cpu.pc & 0xFF), byte(cpu.pc >> 8),
+		byte(cpu.sp & 0xFF), byte(cpu.sp >> 8),
+		cpu.interrupts, cpu.halted
+	};
+
+	for (auto r : regs)
+		fnv(h, r);
+
+	for (int addr = 0; addr < 0x10000; addr++)
+		fnv(h, cpu.mmu.peekb(addr));
+
+	return h;
+}
+
+int main(int argc, char** argv)
+{
+	Options opt;
+
+	try {
+		if (!parseArgs(argc, argv, opt)) {
+			usage();
+			return 1;
+		}
+
+		if (!opt.decodeTrace.empty()) {
+			auto syms = GBEmu::SymbolTable::loadShared(opt.symFiles);
+
+			GBEmu::ExecTrace::decode(opt.decodeTrace, std::cout, syms->empty() ? nullptr : syms.get());
+			return 0;
+		}
+
+		if (!opt.mergeCoverage.empty()) {
+			GBEmu::Coverage merged, next;
+			merged.load(opt.coverageInputs[0]);
+			for (size_t i = 1; i < opt.coverageInputs.size(); i++) {
+				next.load(opt.coverageInputs[i]);
+				merged.merge(next);
+			}
+
+			merged.save(opt.mergeCoverage);
+			if (!opt.coverageReport.empty())
+				writeCoverageReport(opt.coverageReport, merged);
+			return 0;
+		}
+
+		GBEmu::ROM rom;
+		rom.loadfromfile(opt.rom.c_str());
+
+		if (!opt.disassembly.empty()) {
+			auto syms = GBEmu::SymbolTable::loadShared(opt.symFiles);
+
+			GBEmu::CodeIndex index;
+			if (!opt.indexCache.empty())
+				index.loadOrBuild(rom, opt.indexCache);
+			else
+				index.build(rom);
+
+			std::ofstream out(opt.disassembly);
+			if (!out.is_open())
+				throw std::runtime_error("could not write " + opt.disassembly);
+			index.exportListing(rom, out, syms->empty() ? nullptr : syms.get());
+
+			if (!opt.quiet)
+				printf("%llu instructions in %llu banks, %llu xrefs\n", (unsigned long long)index.getInstructionCount(),
+					(unsigned long long)index.getBankCount(), (unsigned long long)index.getXrefs().size());
+			return 0;
+		}
+
+		GBEmu::Z80 cpu;
+		GBEmu::Video vid(&cpu);
+		GBEmu::Joypad pad(&cpu);
+		cpu.mmu.assignrom(&rom);
+
+		if (opt.skipBIOS)
+			cpu.skipBIOS();
+		if (!opt.loadState.empty())
+			GBEmu::loadStateFile(cpu, vid, &pad, opt.loadState);
+
+		GBEmu::Profiler profiler;
+		GBEmu::CallProfiler callProfiler;
+		auto syms = GBEmu::SymbolTable::loadShared(opt.symFiles);
+
+		if (!opt.profile.empty() || !opt.profileFolded.empty())
+			cpu.profiler = &profiler;
+		if (!opt.callgraph.empty() || opt.callgraphTop)
+			cpu.callProfiler = &callProfiler;
+
+		GBEmu::Breakpoints breakpoints;
+		breakpoints.setSymbols(syms);
+		for (auto &b : opt.breaks)
+			breakpoints.add(b);
+		cpu.breakpoints = &breakpoints;
+
+		std::unique_ptr<GBEmu::Coverage> coverage;
+		if (!opt.coverage.empty() || !opt.coverageReport.empty()) {
+			coverage.reset(new GBEmu::Coverage(rom.gethash()));
+			cpu.mmu.coverage = coverage.get();
+		}
+
+		std::unique_ptr<GBEmu::ExecTrace> trace;
+		if (!opt.execTrace.empty()) {
+			trace.reset(new GBEmu::ExecTrace(opt.execTraceSize));
+			trace->setSampling(opt.execTraceEvery);
+			if (!opt.execTraceAt.empty()) {
+				word bank, addr;
+				if (!syms->resolve(opt.execTraceAt, bank, addr)) {
+					auto &at = opt.execTraceAt;
+					size_t colon = at.find(':');
+					bank = colon == std::string::npos ? GBEmu::BANK_ANY : word(strtoul(at.substr(0, colon).c_str(), nullptr, 16));
+					addr = word(strtoul(at.substr(colon == std::string::npos ? 0 : colon + 1).c_str(), nullptr, 16));
+				}
+				trace->setTrigger(bank, addr, opt.execTraceAfter);
+			}
+			cpu.trace = trace.get();
+		}
+
+		// pixels are only made for the frames that get dumped
+		vector<byte> grey(GBEmu::CANVAS_SIZE, 255);
+		uint64_t frame = 0;
+
+		vid.setFrameBuffer(grey.data(), GBEmu::getRowSize(GBEmu::PF_GREY8), GBEmu::PF_GREY8);
+		// the first frame is decided on right away
+		if (wantsDump(opt, 0))
+			vid.requestFrame();
+		vid.setFrameSkip(GBEmu::FRAMESKIP_ONDEMAND);
+
+		vid.addFrameHook([&](const GBEmu::FrameBuffer&) {
+			writePGM(opt.dumpPrefix + std::to_string(frame) + ".pgm", grey.data());
+		});
+
+		if (!opt.trace.empty()) {
+			GBEmu::HostTrace::setThreadName("emulation");
+			GBEmu::HostTrace::setEnabled(true);
+		}
+
+		uint64_t frameStart = GBEmu::HostTrace::now();
+
+		auto nextFrame = [&]() {
+			if (GBEmu::HostTrace::isEnabled()) {
+				uint64_t now = GBEmu::HostTrace::now();
+				GBEmu::HostTrace::record("emulate frame", frameStart, now);
+				frameStart = now;
+			}
+
+			frame++;
+			if (wantsDump(opt, frame))
+				vid.requestFrame();
+		};
+
+		// runs after the frame hook, and asks for the frame about to start
+		vid.addVBlankHook(nextFrame);
+
+		size_t nextInput = 0;
+		uint64_t cycles = 0;
+		// with the lcd off there's no vblank, so frames go by the clock
+		uint32_t offCycles = 0;
+		auto start = std::chrono::steady_clock::now();
+
+		while ((!opt.frames || frame < opt.frames) && (!opt.cycles || cycles < opt.cycles)) {
+			while (nextInput < opt.input.size() && opt.input[nextInput].frame <= frame)
+				pad.setButtons(opt.input[nextInput++].buttons);
+
+			uint32_t before = cpu.clock.machine;
+			if (!cpu.step() && breakpoints.isStopped(cpu)) {
+				auto bp = breakpoints.getLastHit();
+				std::string label;
+				word offset;
+				if (syms->lookup(cpu.mmu.getROMBank(), cpu.pc, label, offset))
+					label = " (" + syms->format(cpu.mmu.getROMBank(), cpu.pc) + ")";
+				printf("breakpoint %d at %02x:%04x%s%s%s\n", bp->id, cpu.mmu.getROMBank(), cpu.pc,
+					label.c_str(), bp->condition.empty() ? "" : " if ", bp->condition.c_str());
+				printf("af %04x bc %04x de %04x hl %04x sp %04x\n", cpu.getAF(), cpu.getBC(), cpu.getDE(), cpu.getHL(), cpu.sp);
+				break;
+			}
+			uint32_t took = uint32_t(cpu.clock.machine - before);
+			cycles += took;
+
+			if (cpu.mmu.peekb(GBEmu::LCDC_ADDR) & 0x80)
+				offCycles = 0;
+			else if ((offCycles += took) >= uint32_t(GBEmu::FRAME_CYCLES)) {
+				offCycles -= GBEmu::FRAME_CYCLES;
+				nextFrame();
+			}
+
+			if (vid.due())
+				vid.sync();
+			cpu.executeinterrupts();
+		}
+
+		double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		// what's read from here on is ours, not the game's
+		cpu.mmu.coverage = nullptr;
+
+		if (!opt.saveState.empty())
+			GBEmu::saveStateFile(cpu, vid, &pad, opt.saveState);
+
+		if (!opt.trace.empty()) {
+			GBEmu::HostTrace::setEnabled(false);
+			GBEmu::HostTrace::exportChromeJSON(opt.trace);
+		}
+
+		if (!opt.dumpRAM.empty()) {
+			std::ofstream out(opt.dumpRAM, std::ios::out | std::ios::binary);
+			if (!out.is_open())
+				throw std::runtime_error("could not write " + opt.dumpRAM);
+
+			for (int addr = 0; addr < 0x10000; addr++)
+				out.put(cpu.mmu.peekb(addr));
+		}
+
+		if (!opt.profile.empty()) {
+			std::ofstream out(opt.profile);
+			if (!out.is_open())
+				throw std::runtime_error("could not write " + opt.profile);
+			profiler.exportFlat(out, syms->empty() ? nullptr : syms.get());
+		}
+
+		if (!opt.profileFolded.empty()) {
+			std::ofstream out(opt.profileFolded);
+			if (!out.is_open())
+				throw std::runtime_error("could not write " + opt.profileFolded);
+			profiler.exportFolded(out, syms->empty() ? nullptr : syms.get());
+		}
+
+		if (trace)
+			trace->save(opt.execTrace);
+
+		if (coverage && !opt.coverage.empty())
+			coverage->save(opt.coverage);
+		if (coverage && !opt.coverageReport.empty())
+			writeCoverageReport(opt.coverageReport, *coverage);
+
+		if (!opt.callgraph.empty()) {
+			std::ofstream out(opt.callgraph);
+			if (!out.is_open())
+				throw std::runtime_error("could not write " + opt.callgraph);
+			callProfiler.exportCallgrind(out, syms->empty() ? nullptr : syms.get());
+		}
+
+		if (opt.callgraphTop)
+			callProfiler.exportText(std::cout, syms->empty() ? nullptr : syms.get(), opt.callgraphTop);
+
+		uint64_t hash = hashState(cpu);
+
+		if (!opt.quiet) {
+			double emulated = cycles * cpu.msPerCycle() / 1000.0;
+			printf("frames %llu cycles %llu pc %04x\n", (unsigned long long)frame, (unsigned long long)cycles, cpu.pc);
+			printf("took %.3fs, %.1fx realtime\n", secs, secs > 0 ? emulated / secs : 0);
+		}
+
+		if (opt.stats) {
+			auto snap = cpu.mmu.stats.snapshot();
+			for (int i = 0; i < GBEmu::STAT_COUNT; i++)
+				printf("%-16s %llu\n", GBEmu::getStatName(GBEmu::STAT(i)), (unsigned long long)snap.get(GBEmu::STAT(i)));
+		}
+
+		printf("state hash %016llx\n", (unsigned long long)hash);
+	}
+	catch (std::exception& e) {
+		std::cerr << "error: " << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,70 @@
+#include "FrameLimiter.h"
+#include <thread>
+#include <algorithm>
+
+namespace GBEmu {
+
+	FrameLimiter::FrameLimiter(double hz)
+	{
+		period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / hz));
+		spinMargin = std::chrono::milliseconds(2);
+		reset();
+		resetDrift();
+	}
+
+	void FrameLimiter::reset()
+	{
+		next = clock::now() + period;
+	}
+
+	void FrameLimiter::wait()
+	{
+		auto now = clock::now();
+
+		// too far behind to make it up (a stall, or we were uncapped). start over
+		// instead of running a burst of frames to catch up.
+		if (now > next + period * 4) {
+			next = now + period;
+			return;
+		}
+
+		auto sleepFor = next - now - spinMargin;
+		if (sleepFor > clock::duration::zero()) {
+			std::this_thread::sleep_for(sleepFor);
+
+			// learn how late the os wakes us up, and spin at least that long next time
+			auto overslept = clock::now() - (now + sleepFor);
+			auto margin = overslept + overslept / 4;
+			spinMargin = std::max(margin, spinMargin - spinMargin / 64);
+			spinMargin = std::min<clock::duration>(std::max<clock::duration>(spinMargin, std::chrono::microseconds(500)), period);
+		}
+
+		while (clock::now() < next)
+			std::this_thread::yield();
+
+		double late = std::chrono::duration<double, std::milli>(clock::now() - next).count();
+		driftTotal += late;
+		driftMax = std::max(driftMax, late);
+		waits++;
+
+		// keep to the absolute schedule so errors don't add up
+		next += period;
+	}
+
+	double FrameLimiter::getAverageDrift() const
+	{
+		return waits ? driftTotal / waits : 0;
+	}
+
+	double FrameLimiter::getMaxDrift() const
+	{
+		return driftMax;
+	}
+
+	void FrameLimiter::resetDrift()
+	{
+		driftTotal = 0;
+		driftMax = 0;
+		waits = 0;
+	}
+}
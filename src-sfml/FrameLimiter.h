@@ -0,0 +1,35 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace GBEmu {
+
+	// paces a loop to a fixed rate. sleeps for most of each frame and spins
+	// for the last bit, with the spin margin following how late sleeps really wake up.
+	class FrameLimiter {
+		typedef std::chrono::steady_clock clock;
+
+		clock::duration period;
+		clock::time_point next;
+		clock::duration spinMargin;
+
+		// how late each wait returned, since the last resetDrift()
+		double driftTotal;
+		double driftMax;
+		uint32_t waits;
+	public:
+		FrameLimiter(double hz);
+
+		// start pacing from now, e.g. after running uncapped
+		void reset();
+
+		// block until the next frame is due
+		void wait();
+
+		// in milliseconds
+		double getAverageDrift() const;
+		double getMaxDrift() const;
+		void resetDrift();
+	};
+}
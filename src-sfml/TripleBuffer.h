@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+
+namespace GBEmu {
+
+	// lock-free handoff of whole frames from one producer thread to one consumer thread.
+	// the producer always has a slot to write to and the consumer always has a complete
+	// frame to show, so neither waits on the other. frames the consumer doesn't get
+	// around to are dropped, never torn.
+	template <class T>
+	class TripleBuffer {
+		T slots[3];
+
+		// slot index the two sides swap through, plus whether it holds an unseen frame
+		std::atomic<int> middle;
+		int back; // producer's
+		int front; // consumer's
+
+		static const int FRESH = 4;
+	public:
+		TripleBuffer() : middle(1), back(0), front(2) {}
+
+		// producer side
+		T& getBack() { return slots[back]; }
+
+		void publish() {
+			back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+		}
+
+		// consumer side. true if a new frame was picked up.
+		bool update() {
+			if (!(middle.load(std::memory_order_relaxed) & FRESH))
+				return false;
+
+			front = middle.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+			return true;
+		}
+
+		const T& getFront() const { return slots[front]; }
+	};
+}
@@ -1,11 +1,25 @@
 #include <SFML/Graphics.hpp>
 
 #include <sstream>
+#include <thread>
+#include <atomic>
 #include "Z80.h"
 #include "Video.h"
+#include "TripleBuffer.h"
+#include "FrameLimiter.h"
+#include "HostTrace.h"
+#include "Rewind.h"
+
+// while turbo is held, only one frame in this many gets drawn and shown
+const int TURBO_PRESENT_EVERY = 10;
+
+struct Frame {
+	GBEmu::Pixel px[GBEmu::CANVAS_SIZE];
+};
 
 int main() {
 	sf::RenderWindow wnd(sf::VideoMode(160 * 4, 144 * 4), "YAGBEMU");
+	wnd.setVerticalSyncEnabled(true);
 
 	sf::Texture canvas;
 	sf::Sprite screen;
@@ -14,7 +28,7 @@ int main() {
 	screen.setTexture(canvas);
 	screen.setScale(4, 4);
 	GBEmu::Z80 cpu;
-	GBEmu::Video vid(&cpu.mmu);
+	GBEmu::Video vid(&cpu);
 	GBEmu::ROM rom;
 	rom.loadfromfile("t.gb");
 	cpu.mmu.assignrom(&rom);
@@ -28,45 +42,172 @@ int main() {
 	notif.setCharacterSize(24);
 	notif.setFillColor(sf::Color::Red);
 
-	bool update = false;
-	vid.addRefreshHook([&](const GBEmu::Pixel *p) {
-		update = true;
-		canvas.update((sf::Uint8*)p, GBEmu::CANVAS_WIDTH, GBEmu::CANVAS_HEIGHT, 0, 0);
+	// the video draws straight into the back slot, and a finished frame
+	// is handed to this thread by swapping slots.
+	auto frames = std::unique_ptr<GBEmu::TripleBuffer<Frame>>(new GBEmu::TripleBuffer<Frame>());
+	std::atomic<int> scy(0);
+
+	vid.setFrameBuffer(frames->getBack().px, GBEmu::getRowSize(GBEmu::PF_RGBA8888), GBEmu::PF_RGBA8888);
+	vid.addRefreshHook([&](const GBEmu::Pixel *) {
+		scy = cpu.mmu.readb(GBEmu::SCY_ADDR);
+		frames->publish();
+		vid.setFrameBuffer(frames->getBack().px, GBEmu::getRowSize(GBEmu::PF_RGBA8888), GBEmu::PF_RGBA8888);
 	});
 
-	int vid_debug = 0;
-	while (wnd.isOpen()) {
+	std::atomic<bool> running(true);
+	std::atomic<bool> turbo(false);
+	std::atomic<bool> rewinding(false);
+	std::atomic<int> vid_debug(0);
+
+	// reported by the emulation thread about once a second
+	std::atomic<double> avgDrift(0), maxDrift(0);
+
+	// the real dmg refresh rate, ~59.73hz
+	GBEmu::FrameLimiter limiter(1000.0 / (GBEmu::FRAME_CYCLES * cpu.msPerCycle()));
+	bool turboing = false;
+	int paced = 0;
+	uint64_t frameStart = GBEmu::HostTrace::now();
+
+	// always on, the last minute or so can be gone back through with backspace
+	GBEmu::Rewind rewind(&cpu, &vid, nullptr);
+	bool frameDone = false;
+
+	// on the emulation thread, once per frame
+	vid.addVBlankHook([&]() {
+		frameDone = true;
+
+		if (GBEmu::HostTrace::isEnabled())
+			GBEmu::HostTrace::record("emulate", frameStart, GBEmu::HostTrace::now());
+
+		if (turboing) {
+			frameStart = GBEmu::HostTrace::now();
+			return;
+		}
+
+		{
+			TRACE_SCOPE("pace");
+			limiter.wait();
+		}
+		frameStart = GBEmu::HostTrace::now();
+
+		if (++paced == 60) {
+			avgDrift = limiter.getAverageDrift();
+			maxDrift = limiter.getMaxDrift();
+			limiter.resetDrift();
+			paced = 0;
+		}
+	});
+
+	// emulation runs on its own, so vsync never holds it up
+	std::thread emu([&]() {
+		int debug = 0;
+		GBEmu::HostTrace::setThreadName("emulation");
 
-		while (!update) {
-			sf::Event evt;
-			while (wnd.pollEvent(evt)) {
-				if (evt.type == sf::Event::Closed) return 0;
-				if (evt.type == sf::Event::KeyPressed && evt.key.code == sf::Keyboard::A) {
-					vid_debug++;
-					vid_debug %= 5;
-					std::stringstream ss;
-					ss << "YAGBEMU debug video mode: " << vid_debug;
-					wnd.setTitle(ss.str());
-				}
+		while (running) {
+			if (debug != vid_debug) {
+				debug = vid_debug;
+				vid.setDebugMode((GBEmu::VIDEO_DEBUGMODE)debug);
 			}
 
-			byte c = cpu.step();
-			vid.updateTimer(c, &cpu, (GBEmu::VIDEO_DEBUGMODE)vid_debug);
+			if (turboing != turbo) {
+				turboing = turbo;
+				vid.setFrameSkip(turboing ? TURBO_PRESENT_EVERY - 1 : 0);
+				limiter.reset();
+			}
+
+			cpu.step();
+			if (vid.due())
+				vid.sync();
 			cpu.executeinterrupts();
+
+			// the hook runs mid sync, states are only taken between steps
+			if (frameDone) {
+				frameDone = false;
+				TRACE_SCOPE("rewind");
+				if (rewinding)
+					rewind.rewind();
+				else
+					rewind.onFrame();
+			}
 		}
+	});
+
+	sf::Clock titleClock;
+	GBEmu::HostTrace::setThreadName("frontend");
 
-		wnd.clear();
-		wnd.draw(screen);
-		
-		std::stringstream ss;
-		ss << (int)cpu.mmu.readb(GBEmu::SCY_ADDR);
-		notif.setString(ss.str());
-		wnd.draw(notif);
+	while (wnd.isOpen()) {
+		sf::Event evt;
+		while (wnd.pollEvent(evt)) {
+			if (evt.type == sf::Event::Closed)
+				wnd.close();
+			if (evt.type == sf::Event::KeyPressed && evt.key.code == sf::Keyboard::A) {
+				vid_debug = (vid_debug + 1) % 5;
+			}
+			// hold tab to run uncapped
+			if (evt.type == sf::Event::KeyPressed && evt.key.code == sf::Keyboard::Tab)
+				turbo = true;
+			if (evt.type == sf::Event::KeyReleased && evt.key.code == sf::Keyboard::Tab)
+				turbo = false;
+			// hold backspace to go back in time
+			if (evt.type == sf::Event::KeyPressed && evt.key.code == sf::Keyboard::BackSpace)
+				rewinding = true;
+			if (evt.type == sf::Event::KeyReleased && evt.key.code == sf::Keyboard::BackSpace)
+				rewinding = false;
+			if (evt.type == sf::Event::LostFocus) {
+				turbo = false;
+				rewinding = false;
+			}
+			// t starts a host trace, and t again writes it out to trace.json
+			if (evt.type == sf::Event::KeyPressed && evt.key.code == sf::Keyboard::T) {
+				bool tracing = !GBEmu::HostTrace::isEnabled();
+				GBEmu::HostTrace::setEnabled(tracing);
 
+				if (tracing)
+					GBEmu::HostTrace::clear();
+				else
+					GBEmu::HostTrace::exportChromeJSON("trace.json");
+			}
+		}
 
-		wnd.display();
+		if (titleClock.getElapsedTime().asSeconds() >= 1) {
+			std::stringstream ss;
+			ss << "YAGBEMU debug video mode: " << vid_debug;
+			if (rewinding)
+				ss << " [rewind]";
+			else if (turbo)
+				ss << " [turbo]";
+			else
+				ss << " drift avg " << avgDrift << "ms max " << maxDrift << "ms";
+			wnd.setTitle(ss.str());
+			titleClock.restart();
+		}
 
-		
-		update = false;
+		// nothing new to show, don't spin
+		if (!frames->update()) {
+			sf::sleep(sf::milliseconds(1));
+			continue;
+		}
+
+		{
+			TRACE_SCOPE("canvas.update");
+			canvas.update((sf::Uint8*)frames->getFront().px, GBEmu::CANVAS_WIDTH, GBEmu::CANVAS_HEIGHT, 0, 0);
+		}
+
+		{
+			TRACE_SCOPE("draw");
+			wnd.clear();
+			wnd.draw(screen);
+
+			std::stringstream ss;
+			ss << scy;
+			notif.setString(ss.str());
+			wnd.draw(notif);
+		}
+
+		TRACE_SCOPE("display");
+		wnd.display();
 	}
-}
\ No newline at end of file
+
+	running = false;
+	emu.join();
+}
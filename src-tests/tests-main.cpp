@@ -0,0 +1,378 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "Z80.h"
+#include "Video.h"
+#include "Breakpoints.h"
+#include "ExecTrace.h"
+#include "ReverseDebugger.h"
+#include "SaveState.h"
+#include "Machine.h"
+
+// regression tests for the core, on little roms put together in memory so
+// there's nothing to find on disk. prints each test and returns how many
+// failed.
+//
+// usage: gbemu-tests
+
+namespace {
+	using namespace GBEmu;
+
+	void expect(bool ok, const std::string& what)
+	{
+		if (!ok)
+			throw std::runtime_error(what);
+	}
+
+	// an mbc1 image with `banks` banks of halts, code goes in with put()
+	struct TestROM {
+		vbyte bin;
+
+		explicit TestROM(int banks)
+		{
+			bin.assign(banks * 0x4000, 0x76);
+			memset(&bin[0x100], 0, 0x50);
+			bin[0x147] = 1;
+			bin[0x148] = banks > 2 ? byte(banks / 4) : 0;
+		}
+
+		void put(int bank, word addr, const vbyte& code)
+		{
+			size_t at = bank * 0x4000 + (addr & 0x3FFF);
+			std::copy(code.begin(), code.end(), bin.begin() + at);
+		}
+	};
+
+	// runs until step() comes back 0 or steps run out, true on a stop
+	bool run(Z80& cpu, Video& vid, int steps)
+	{
+		for (int i = 0; i < steps; i++) {
+			if (!cpu.step())
+				return true;
+			if (vid.due())
+				vid.sync();
+			cpu.executeinterrupts();
+		}
+		return false;
+	}
+
+	// switches to bank 2 and loops at 4123 in it
+	TestROM bankedLoop()
+	{
+		TestROM rom(4);
+		rom.put(0, 0x100, { 0x3E, 0x02, 0xEA, 0x00, 0x20, 0xC3, 0x23, 0x41 }); // ld a,2; ld (2000),a; jp 4123
+		rom.put(2, 0x4123, { 0x00, 0x18, 0xFD }); // nop; jr 4123
+		return rom;
+	}
+
+	// a cpu and video on a test rom, past the bios
+	struct TestMachine {
+		ROM rom;
+		std::unique_ptr<Z80> cpu;
+		Video vid;
+
+		explicit TestMachine(const TestROM& image) : cpu(new Z80()), vid(cpu.get())
+		{
+			rom.loadfrombuffer(image.bin);
+			cpu->mmu.assignrom(&rom);
+			cpu->mmu.setMBC1(rom.ismbc1());
+			cpu->skipBIOS();
+		}
+
+		bool run(int steps)
+		{
+			return ::run(*cpu, vid, steps);
+		}
+	};
+
+	bool stopsAt(const std::string& spec)
+	{
+		TestMachine m(bankedLoop());
+		Z80* cpu = m.cpu.get();
+
+		Breakpoints bps;
+		bps.add(spec);
+		cpu->breakpoints = &bps;
+
+		return m.run(1000) && bps.isStopped(*cpu) && cpu->pc == 0x4123;
+	}
+
+	void romxBreakpoints()
+	{
+		expect(stopsAt("4123"), "a romx breakpoint with no bank didn't stop");
+		expect(stopsAt("2:4123"), "a breakpoint in the mapped bank didn't stop");
+		expect(!stopsAt("3:4123"), "a breakpoint in another bank stopped");
+	}
+
+	// LY isn't stored anywhere, it's worked out when read
+	void conditionsSeeLY()
+	{
+		TestMachine m(bankedLoop());
+		Breakpoints bps;
+		bps.add("4123 if [$ff44] == $90");
+		m.cpu->breakpoints = &bps;
+
+		expect(m.run(100000) && bps.isStopped(*m.cpu), "a condition on LY never matched");
+		expect(m.vid.getLY() == 0x90, "stopped with LY at " + std::to_string(m.vid.getLY()));
+	}
+
+	// the trigger pc is only run once here, and sampling would skip it
+	void sampledTraceTrigger()
+	{
+		TestMachine m(bankedLoop());
+		ExecTrace trace(64);
+		trace.setSampling(5);
+		trace.setTrigger(BANK_ANY, 0x4123, 0);
+		m.cpu->trace = &trace;
+
+		// past the loop's first nop, then once around it
+		m.run(5);
+		expect(trace.isStopped(), "a bankless trigger that sampling skips didn't stop the trace");
+
+		auto records = trace.getRecords();
+		expect(!records.empty() && records.back().pc == 0x4123 && (records.back().flags & TRACE_TRIGGER),
+			"the trigger instruction wasn't recorded");
+	}
+
+	// rst and interrupts push the address of the next instruction below
+	// sp, the same as call, so ret and reti come back to it
+	void returnAddresses()
+	{
+		TestROM rom(2);
+		rom.put(0, 0x08, { 0xC9 }); // ret
+		rom.put(0, 0x40, { 0xD9 }); // reti
+		rom.put(0, 0x100, { 0x31, 0xF0, 0xDF, 0xCF, 0x00, 0x00 }); // ld sp,dff0; rst 08; nop; nop
+
+		TestMachine m(rom);
+		Z80* cpu = m.cpu.get();
+		cpu->interrupts = false;
+
+		m.run(2);
+		expect(cpu->pc == 0x08 && cpu->sp == 0xDFEE, "rst didn't push below sp");
+		m.run(1);
+		expect(cpu->pc == 0x104 && cpu->sp == 0xDFF0, "rst didn't return to the next instruction");
+
+		cpu->mmu.rawwriteb(0xFFFF, 1 << Z80::int_vblank);
+		cpu->runInterrupt(Z80::int_vblank);
+		cpu->interrupts = true;
+		cpu->executeinterrupts();
+		expect(cpu->pc == 0x40 && cpu->sp == 0xDFEE, "the interrupt didn't push below sp");
+		expect(!(cpu->mmu.rawreadb(0xFF0F) & (1 << Z80::int_vblank)), "taking the interrupt didn't clear its request");
+
+		cpu->step();
+		expect(cpu->pc == 0x104 && cpu->sp == 0xDFF0, "reti didn't return to where the interrupt came in");
+	}
+
+	// going back replays from a snapshot, which already ran once
+	void replaysNotCounted()
+	{
+		TestMachine m(bankedLoop());
+		ReverseDebugger rev(m.cpu.get(), &m.vid, nullptr);
+		rev.run(100);
+
+		uint64_t before = m.cpu->mmu.stats.snapshot().get(STAT_INSTRUCTIONS);
+		expect(rev.stepBack(10), "couldn't step back");
+		uint64_t after = m.cpu->mmu.stats.snapshot().get(STAT_INSTRUCTIONS);
+		expect(before == after, "stepping back counted " + std::to_string(after - before) + " more instructions");
+	}
+
+	// keeps rewriting tile data with scx following along, so every frame
+	// and most lines differ
+	TestROM scroller()
+	{
+		TestROM rom(2);
+		rom.put(0, 0x100, {
+			0x21, 0x00, 0x80, // ld hl,8000
+			0x7D,             // ld a,l
+			0x22,             // ld (hl+),a
+			0xE0, 0x43,       // ldh (43),a
+			0x7C,             // ld a,h
+			0xFE, 0x98,       // cp 98
+			0x20, 0xF7,       // jr nz,103
+			0x26, 0x80,       // ld h,80
+			0x18, 0xF3,       // jr 103
+		});
+		return rom;
+	}
+
+	// rewrites all the tile data with a different pattern each time round,
+	// so frames change now and then and most lines come out the same
+	TestROM tileWriter()
+	{
+		TestROM rom(2);
+		rom.put(0, 0x100, {
+			0x21, 0x00, 0x80, // ld hl,8000
+			0x7D,             // ld a,l
+			0xA8,             // xor b
+			0x22,             // ld (hl+),a
+			0x7C,             // ld a,h
+			0xFE, 0x98,       // cp 98
+			0x20, 0xF8,       // jr nz,103
+			0x04,             // inc b
+			0x18, 0xF2,       // jr 100
+		});
+		return rom;
+	}
+
+	// a checksum of each frame, with the frame hooks flipping the target
+	// between two buffers like a front end would
+	std::vector<uint64_t> frameHashes(const TestROM& image, bool threaded, bool lineCache = false, LineCacheStats* stats = nullptr)
+	{
+		std::vector<byte> bufs[2] = { std::vector<byte>(CANVAS_SIZE), std::vector<byte>(CANVAS_SIZE) };
+		std::vector<uint64_t> hashes;
+		TestMachine m(image);
+
+		m.vid.setFrameBuffer(bufs[0].data(), getRowSize(PF_GREY8), PF_GREY8);
+		m.vid.addFrameHook([&](const FrameBuffer& fb) {
+			uint64_t h = 14695981039346656037ull;
+			for (uint32_t i = 0; i < CANVAS_SIZE; i++)
+				h = (h ^ ((const byte*)fb.data)[i]) * 1099511628211ull;
+			hashes.push_back(h);
+
+			m.vid.setFrameBuffer(bufs[hashes.size() % 2].data(), getRowSize(PF_GREY8), PF_GREY8);
+		});
+		m.vid.setThreaded(threaded);
+		m.vid.setLineCache(lineCache);
+
+		m.run(300000);
+		m.vid.waitForRender();
+		expect(m.vid.getFrameBuffer().data == bufs[hashes.size() % 2].data(),
+			"the target a frame hook picked didn't make it back to getFrameBuffer");
+
+		m.vid.setThreaded(false);
+		if (stats)
+			*stats = m.vid.getLineCacheStats();
+		return hashes;
+	}
+
+	void threadedMatches()
+	{
+		auto single = frameHashes(scroller(), false);
+		auto threaded = frameHashes(scroller(), true);
+
+		expect(single.size() > 10, "only " + std::to_string(single.size()) + " frames were drawn");
+		expect(threaded == single, "threaded frames differ");
+	}
+
+	void lineCacheMatches()
+	{
+		LineCacheStats stats;
+		auto cached = frameHashes(tileWriter(), false, true, &stats);
+		auto uncached = frameHashes(tileWriter(), false);
+
+		expect(stats.hits > 0 && stats.misses > 0, "the line cache wasn't exercised, " +
+			std::to_string(stats.hits) + " hits and " + std::to_string(stats.misses) + " misses");
+		expect(cached == uncached, "frames from the line cache differ");
+	}
+
+	vbyte stateOf(const Z80& cpu, const Video& vid, const Joypad* pad = nullptr)
+	{
+		vbyte state(getSaveStateSize(pad != nullptr));
+		saveState(cpu, vid, pad, state.data(), state.size());
+		return state;
+	}
+
+	void saveStateResumes()
+	{
+		TestMachine a(scroller());
+		a.run(50000);
+		vbyte saved = stateOf(*a.cpu, a.vid);
+
+		TestMachine b(scroller());
+		loadState(*b.cpu, b.vid, nullptr, saved.data(), saved.size());
+		expect(stateOf(*b.cpu, b.vid) == saved, "a loaded state saves differently");
+
+		a.run(50000);
+		b.run(50000);
+		expect(stateOf(*b.cpu, b.vid) == stateOf(*a.cpu, a.vid), "a loaded state ran differently");
+	}
+
+	// back past a few snapshots, so it's a restore and a replay
+	void stepBackRestores()
+	{
+		TestMachine m(scroller());
+		ReverseDebugger rev(m.cpu.get(), &m.vid, nullptr);
+		rev.run(20000);
+
+		uint64_t position = rev.getPosition();
+		vbyte then = stateOf(*m.cpu, m.vid);
+
+		rev.run(10000);
+		expect(rev.getSnapshotCount() > 2, "no snapshots were taken on the way");
+		expect(rev.stepBack(10000), "couldn't step back");
+		expect(rev.getPosition() == position, "stepped back to the wrong position");
+		expect(stateOf(*m.cpu, m.vid) == then, "stepping back didn't give the same state");
+	}
+
+	vbyte stateOf(const Machine& m)
+	{
+		return stateOf(m.cpu, m.vid, &m.pad);
+	}
+
+	void forksMatchParent()
+	{
+		TestROM image = scroller();
+		ROM rom;
+		rom.loadfrombuffer(image.bin);
+
+		Machine parent(&rom);
+		parent.cpu.mmu.setMBC1(rom.ismbc1());
+		parent.cpu.skipBIOS();
+		for (int i = 0; i < 50000; i++)
+			parent.step();
+
+		auto child = parent.fork();
+		expect(stateOf(*child) == stateOf(parent), "a new fork differs from its parent");
+
+		// apart for a while, then the cheap way back, which only copies what changed
+		for (int i = 0; i < 30000; i++)
+			parent.step();
+		for (int i = 0; i < 20000; i++)
+			child->step();
+		child->forkFrom(parent);
+		expect(stateOf(*child) == stateOf(parent), "forking into a machine differs from its parent");
+
+		for (int i = 0; i < 20000; i++) {
+			parent.step();
+			child->step();
+		}
+		expect(stateOf(*child) == stateOf(parent), "a fork ran differently from its parent");
+	}
+
+	struct Test {
+		const char* name;
+		void(*run)();
+	};
+
+	const Test tests[] = {
+		{ "rst and interrupt returns", returnAddresses },
+		{ "romx breakpoints", romxBreakpoints },
+		{ "conditions see LY", conditionsSeeLY },
+		{ "sampled trace trigger", sampledTraceTrigger },
+		{ "replays aren't counted", replaysNotCounted },
+		{ "threaded frames match", threadedMatches },
+		{ "line cache matches", lineCacheMatches },
+		{ "save states resume", saveStateResumes },
+		{ "stepping back restores", stepBackRestores },
+		{ "forks match their parent", forksMatchParent },
+	};
+}
+
+int main()
+{
+	int failed = 0;
+	for (auto& t : tests) {
+		try {
+			t.run();
+			std::cout << "ok    " << t.name << std::endl;
+		}
+		catch (std::exception& e) {
+			std::cout << "FAIL  " << t.name << ": " << e.what() << std::endl;
+			failed++;
+		}
+	}
+
+	std::cout << failed << " failed" << std::endl;
+	return failed;
+}
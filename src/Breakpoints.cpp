@@ -0,0 +1,493 @@
+#include "Breakpoints.h"
+#include "Z80.h"
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+
+namespace GBEmu {
+	namespace {
+		enum REGISTER {
+			REG_A, REG_B, REG_C, REG_D, REG_E, REG_F, REG_H, REG_L,
+			REG_AF, REG_BC, REG_DE, REG_HL, REG_SP, REG_PC,
+			REG_ZF, REG_NF, REG_HF, REG_CF
+		};
+
+		const char* registerNames[] = {
+			"a", "b", "c", "d", "e", "f", "h", "l",
+			"af", "bc", "de", "hl", "sp", "pc",
+			"zf", "nf", "hf", "cf"
+		};
+
+		int32_t readRegister(const Z80& cpu, int32_t reg)
+		{
+			switch (reg) {
+			case REG_A: return cpu.a;
+			case REG_B: return cpu.b;
+			case REG_C: return cpu.c;
+			case REG_D: return cpu.d;
+			case REG_E: return cpu.e;
+			case REG_F: return cpu.f;
+			case REG_H: return cpu.h;
+			case REG_L: return cpu.l;
+			case REG_AF: return packWord(cpu.a, cpu.f);
+			case REG_BC: return packWord(cpu.b, cpu.c);
+			case REG_DE: return packWord(cpu.d, cpu.e);
+			case REG_HL: return packWord(cpu.h, cpu.l);
+			case REG_SP: return cpu.sp;
+			case REG_PC: return cpu.pc;
+			case REG_ZF: return (cpu.f & Z80::zf) != 0;
+			case REG_NF: return (cpu.f & Z80::opf) != 0;
+			case REG_HF: return (cpu.f & Z80::hcf) != 0;
+			case REG_CF: return (cpu.f & Z80::cf) != 0;
+			}
+			return 0;
+		}
+	}
+
+	// recursive descent, one function per precedence level, emitting as it goes
+	class ConditionParser {
+	public:
+		ConditionParser(const std::string& expr, vector<Condition::Instr>& code, const SymbolTable* syms)
+			: s(expr), pos(0), code(code), syms(syms), depth(0), maxDepth(0) {}
+
+		void parse()
+		{
+			orExpr();
+			skipSpace();
+			if (pos != s.size())
+				fail("unexpected \"" + s.substr(pos) + "\"");
+			if (maxDepth > Condition::MAX_STACK)
+				fail("too deeply nested");
+		}
+
+	private:
+		const std::string& s;
+		size_t pos;
+		vector<Condition::Instr>& code;
+		const SymbolTable* syms;
+		int depth, maxDepth;
+
+		void fail(const std::string& why)
+		{
+			throw std::runtime_error("condition \"" + s + "\": " + why);
+		}
+
+		void skipSpace()
+		{
+			while (pos < s.size() && isspace((unsigned char)s[pos]))
+				pos++;
+		}
+
+		bool accept(const char* tok)
+		{
+			skipSpace();
+			size_t len = strlen(tok);
+			if (s.compare(pos, len, tok) != 0)
+				return false;
+
+			// don't take the & of && or the < of <=
+			if (len == 1 && pos + 1 < s.size()) {
+				char next = s[pos + 1];
+				if ((tok[0] == '&' || tok[0] == '|') && next == tok[0])
+					return false;
+				if ((tok[0] == '<' || tok[0] == '>' || tok[0] == '!') && next == '=')
+					return false;
+			}
+
+			pos += len;
+			return true;
+		}
+
+		// pushes grow the stack, binary ops shrink it
+		void emit(Condition::OPCODE op, int32_t arg = 0)
+		{
+			code.push_back(Condition::Instr{ op, arg });
+
+			if (op == Condition::OP_CONST || op == Condition::OP_REG)
+				maxDepth = std::max(maxDepth, ++depth);
+			else if (op >= Condition::OP_MUL)
+				depth--;
+		}
+
+		void orExpr()
+		{
+			andExpr();
+			while (accept("||")) { andExpr(); emit(Condition::OP_LOR); }
+		}
+
+		void andExpr()
+		{
+			bitOr();
+			while (accept("&&")) { bitOr(); emit(Condition::OP_LAND); }
+		}
+
+		void bitOr()
+		{
+			bitXor();
+			while (accept("|")) { bitXor(); emit(Condition::OP_OR); }
+		}
+
+		void bitXor()
+		{
+			bitAnd();
+			while (accept("^")) { bitAnd(); emit(Condition::OP_XOR); }
+		}
+
+		void bitAnd()
+		{
+			equality();
+			while (accept("&")) { equality(); emit(Condition::OP_AND); }
+		}
+
+		void equality()
+		{
+			relational();
+			while (true) {
+				if (accept("==")) { relational(); emit(Condition::OP_EQ); }
+				else if (accept("!=")) { relational(); emit(Condition::OP_NE); }
+				else break;
+			}
+		}
+
+		void relational()
+		{
+			additive();
+			while (true) {
+				if (accept("<=")) { additive(); emit(Condition::OP_LE); }
+				else if (accept(">=")) { additive(); emit(Condition::OP_GE); }
+				else if (accept("<")) { additive(); emit(Condition::OP_LT); }
+				else if (accept(">")) { additive(); emit(Condition::OP_GT); }
+				else break;
+			}
+		}
+
+		void additive()
+		{
+			multiplicative();
+			while (true) {
+				if (accept("+")) { multiplicative(); emit(Condition::OP_ADD); }
+				else if (accept("-")) { multiplicative(); emit(Condition::OP_SUB); }
+				else break;
+			}
+		}
+
+		void multiplicative()
+		{
+			unary();
+			while (accept("*")) { unary(); emit(Condition::OP_MUL); }
+		}
+
+		void unary()
+		{
+			if (accept("!")) { unary(); emit(Condition::OP_NOT); }
+			else if (accept("-")) { unary(); emit(Condition::OP_NEG); }
+			else if (accept("~")) { unary(); emit(Condition::OP_INV); }
+			else primary();
+		}
+
+		void primary()
+		{
+			skipSpace();
+			if (pos == s.size())
+				fail("ends too soon");
+
+			if (accept("(")) {
+				orExpr();
+				if (!accept(")"))
+					fail("missing )");
+				return;
+			}
+
+			if (accept("[")) {
+				orExpr();
+				if (!accept("]"))
+					fail("missing ]");
+				emit(Condition::OP_LOAD);
+				return;
+			}
+
+			if (s[pos] == '$' || isdigit((unsigned char)s[pos])) {
+				int base = 10;
+				if (s[pos] == '$') {
+					base = 16;
+					pos++;
+				}
+				else if (s.compare(pos, 2, "0x") == 0 || s.compare(pos, 2, "0X") == 0) {
+					base = 16;
+					pos += 2;
+				}
+
+				size_t start = pos;
+				while (pos < s.size() && (base == 16 ? isxdigit((unsigned char)s[pos]) : isdigit((unsigned char)s[pos])))
+					pos++;
+				if (start == pos)
+					fail("bad number");
+
+				emit(Condition::OP_CONST, int32_t(strtol(s.substr(start, pos - start).c_str(), nullptr, base)));
+				return;
+			}
+
+			// what rgbds allows in labels, locals included
+			size_t start = pos;
+			while (pos < s.size() && (isalnum((unsigned char)s[pos]) || strchr("_.#@", s[pos])))
+				pos++;
+
+			std::string label = s.substr(start, pos - start);
+			std::string name = label;
+			for (auto &ch : name)
+				ch = tolower((unsigned char)ch);
+
+			for (int r = 0; r < int(sizeof(registerNames) / sizeof(registerNames[0])); r++) {
+				if (name == registerNames[r]) {
+					emit(Condition::OP_REG, r);
+					return;
+				}
+			}
+
+			word bank, addr;
+			if (syms && !label.empty() && syms->find(label, bank, addr)) {
+				emit(Condition::OP_CONST, addr);
+				return;
+			}
+
+			if (name.empty())
+				fail("unexpected \"" + s.substr(start) + "\"");
+			fail(syms ? "unknown register or label " + label : "unknown register " + name);
+		}
+	};
+
+	Condition::Condition()
+	{
+	}
+
+	Condition::Condition(const std::string& expr, const SymbolTable* syms)
+	{
+		ConditionParser(expr, code, syms).parse();
+	}
+
+	bool Condition::empty() const
+	{
+		return code.empty();
+	}
+
+	int32_t Condition::evaluate(const Z80& cpu) const
+	{
+		int32_t stack[MAX_STACK];
+		int sp = -1;
+
+		for (auto &i : code) {
+			switch (i.op) {
+			case OP_CONST: stack[++sp] = i.arg; break;
+			case OP_REG: stack[++sp] = readRegister(cpu, i.arg); break;
+			case OP_LOAD: stack[sp] = cpu.mmu.peekb(word(stack[sp])); break;
+			case OP_NOT: stack[sp] = !stack[sp]; break;
+			case OP_NEG: stack[sp] = -stack[sp]; break;
+			case OP_INV: stack[sp] = ~stack[sp]; break;
+			default: {
+				int32_t rhs = stack[sp--];
+				int32_t& lhs = stack[sp];
+				switch (i.op) {
+				case OP_MUL: lhs *= rhs; break;
+				case OP_ADD: lhs += rhs; break;
+				case OP_SUB: lhs -= rhs; break;
+				case OP_LT: lhs = lhs < rhs; break;
+				case OP_LE: lhs = lhs <= rhs; break;
+				case OP_GT: lhs = lhs > rhs; break;
+				case OP_GE: lhs = lhs >= rhs; break;
+				case OP_EQ: lhs = lhs == rhs; break;
+				case OP_NE: lhs = lhs != rhs; break;
+				case OP_AND: lhs &= rhs; break;
+				case OP_XOR: lhs ^= rhs; break;
+				case OP_OR: lhs |= rhs; break;
+				case OP_LAND: lhs = lhs && rhs; break;
+				case OP_LOR: lhs = lhs || rhs; break;
+				default: break;
+				}
+			}
+			}
+		}
+
+		return sp >= 0 ? stack[sp] : 1;
+	}
+
+	Breakpoints::Breakpoints()
+	{
+		nextID = 1;
+		clear();
+	}
+
+	int Breakpoints::add(word bank, word addr, const std::string& condition)
+	{
+		Breakpoint bp;
+		bp.id = nextID++;
+		bp.bank = (addr >= 0x4000 && addr < 0x8000) ? bank : 0;
+		bp.addr = addr;
+		bp.condition = condition;
+		if (!condition.empty())
+			bp.compiled = Condition(condition, symbols.get());
+		bp.enabled = true;
+		bp.hits = 0;
+
+		list.push_back(bp);
+		rebuild();
+		return bp.id;
+	}
+
+	int Breakpoints::add(const std::string& spec)
+	{
+		std::string where = spec, condition;
+		size_t cond = spec.find(" if ");
+		if (cond != std::string::npos) {
+			where = spec.substr(0, cond);
+			condition = spec.substr(cond + 4);
+		}
+
+		word symBank, symAddr;
+		if (symbols && symbols->resolve(where, symBank, symAddr))
+			return add(symBank, symAddr, condition);
+
+		size_t colon = where.find(':');
+		const char* addr = where.c_str() + (colon == std::string::npos ? 0 : colon + 1);
+		char* end;
+
+		word bank = colon == std::string::npos ? BANK_ANY : word(strtoul(where.c_str(), nullptr, 16));
+		unsigned long pc = strtoul(addr, &end, 16);
+		if (end == addr || pc > 0xFFFF)
+			throw std::runtime_error("breakpoint \"" + spec + "\" needs a hex address" + (symbols ? " or a label" : ""));
+
+		return add(bank, word(pc), condition);
+	}
+
+	void Breakpoints::setSymbols(std::shared_ptr<const SymbolTable> syms)
+	{
+		symbols = syms;
+	}
+
+	const SymbolTable* Breakpoints::getSymbols() const
+	{
+		return symbols.get();
+	}
+
+	bool Breakpoints::remove(int id)
+	{
+		for (size_t i = 0; i < list.size(); i++) {
+			if (list[i].id == id) {
+				list.erase(list.begin() + i);
+				if (lastHit == id)
+					lastHit = 0;
+				rebuild();
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool Breakpoints::setEnabled(int id, bool enabled)
+	{
+		for (auto &bp : list) {
+			if (bp.id == id) {
+				bp.enabled = enabled;
+				rebuild();
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void Breakpoints::clear()
+	{
+		list.clear();
+		lastHit = 0;
+		resuming = false;
+		rebuild();
+	}
+
+	void Breakpoints::rebuild()
+	{
+		bits.assign(0x10000 / 64, 0);
+		armed = 0;
+
+		for (auto &bp : list) {
+			if (!bp.enabled)
+				continue;
+			bits[bp.addr >> 6] |= uint64_t(1) << (bp.addr & 63);
+			armed++;
+		}
+	}
+
+	const vector<Breakpoints::Breakpoint>& Breakpoints::getAll() const
+	{
+		return list;
+	}
+
+	const Breakpoints::Breakpoint* Breakpoints::getLastHit() const
+	{
+		for (auto &bp : list) {
+			if (bp.id == lastHit)
+				return &bp;
+		}
+
+		return nullptr;
+	}
+
+	bool Breakpoints::isStopped(const Z80& cpu) const
+	{
+		return resuming && cpu.pc == resumePC && cpu.clock.machine == resumeClock;
+	}
+
+	void Breakpoints::resumeFrom(const Z80& cpu)
+	{
+		resuming = true;
+		resumePC = cpu.pc;
+		resumeClock = cpu.clock.machine;
+	}
+
+	bool Breakpoints::check(const Z80& cpu)
+	{
+		if (!isSet(cpu.pc))
+			return false;
+
+		// nothing has run since we stopped here
+		if (isStopped(cpu)) {
+			resuming = false;
+			return false;
+		}
+
+		int i = findMatch(cpu);
+		if (i < 0)
+			return false;
+
+		list[i].hits++;
+		lastHit = list[i].id;
+		resumeFrom(cpu);
+		return true;
+	}
+
+	const Breakpoints::Breakpoint* Breakpoints::match(const Z80& cpu) const
+	{
+		int i = findMatch(cpu);
+		return i < 0 ? nullptr : &list[i];
+	}
+
+	int Breakpoints::findMatch(const Z80& cpu) const
+	{
+		if (!isSet(cpu.pc))
+			return -1;
+
+		bool banked = cpu.pc >= 0x4000 && cpu.pc < 0x8000;
+		word bank = banked ? cpu.mmu.getROMBank() : 0;
+
+		for (size_t i = 0; i < list.size(); i++) {
+			const Breakpoint& bp = list[i];
+			if (!bp.enabled || bp.addr != cpu.pc || (bp.bank != bank && bp.bank != BANK_ANY))
+				continue;
+			if (!bp.compiled.empty() && !bp.compiled.evaluate(cpu))
+				continue;
+			return int(i);
+		}
+
+		return -1;
+	}
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "types.h"
+#include "SymbolTable.h"
+#include <string>
+
+namespace GBEmu {
+	class Z80;
+
+	// an expression on registers and memory, compiled once into a little
+	// stack program, e.g. "a == $10 && [hl] != 0". registers are a, b, c, d,
+	// e, f, h, l, af, bc, de, hl, sp and pc, flags zf, nf, hf and cf. [x] is
+	// the byte at x. numbers are decimal, $hex or 0xhex. the operators are
+	// c's, with c's precedence, and && and || don't short circuit. with
+	// symbols, any other name is the address of that label, so
+	// "[wLives] == 0" works.
+	class Condition {
+	public:
+		Condition();
+		// throws runtime_error on anything it can't make sense of
+		explicit Condition(const std::string& expr, const SymbolTable* syms = nullptr);
+
+		bool empty() const;
+		int32_t evaluate(const Z80& cpu) const;
+
+	private:
+		enum OPCODE : byte {
+			OP_CONST, OP_REG, OP_LOAD,
+			OP_NOT, OP_NEG, OP_INV,
+			OP_MUL, OP_ADD, OP_SUB,
+			OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE,
+			OP_AND, OP_XOR, OP_OR, OP_LAND, OP_LOR
+		};
+
+		struct Instr {
+			OPCODE op;
+			int32_t arg;
+		};
+
+		static const int MAX_STACK = 16;
+
+		vector<Instr> code;
+
+		friend class ConditionParser;
+	};
+
+	// pc breakpoints, any number of them, each with an optional condition.
+	// the cpu looks at one bit per instruction, and only while something is
+	// armed, so running to a breakpoint costs about as much as running.
+	class Breakpoints {
+	public:
+		struct Breakpoint {
+			int id;
+			word bank; // only looked at for romx, can be BANK_ANY
+			word addr;
+			std::string condition;
+			Condition compiled;
+			bool enabled;
+			uint64_t hits;
+		};
+
+		Breakpoints();
+
+		int add(word bank, word addr, const std::string& condition = "");
+		// "[BANK:]ADDR [if CONDITION]", addresses in hex. with no bank, a romx
+		// address stops in any bank. with symbols, "Label[+N] [if CONDITION]"
+		// too.
+		int add(const std::string& spec);
+
+		// labels for add() and conditions. already added ones stay as they were.
+		void setSymbols(std::shared_ptr<const SymbolTable> syms);
+		const SymbolTable* getSymbols() const;
+		bool remove(int id);
+		bool setEnabled(int id, bool enabled);
+		void clear();
+
+		const vector<Breakpoint>& getAll() const;
+		// the one that stopped the cpu last, nullptr before any
+		const Breakpoint* getLastHit() const;
+		// the cpu is sitting on the breakpoint it stopped at. step() also
+		// returns 0 on illegal instructions, this tells them apart.
+		bool isStopped(const Z80& cpu) const;
+
+		bool isArmed() const {
+			return armed > 0;
+		}
+
+		// some breakpoint is at pc, in some bank
+		bool isSet(word pc) const {
+			return (bits[pc >> 6] >> (pc & 63)) & 1;
+		}
+
+		// the breakpoint the cpu is at, condition and all, or nullptr.
+		// doesn't count as a hit.
+		const Breakpoint* match(const Z80& cpu) const;
+
+		// the cpu was put here by other means (e.g. going back in time), so
+		// don't stop before the instruction it's at
+		void resumeFrom(const Z80& cpu);
+
+		// true if the cpu should stop before the instruction at pc. the
+		// next check after a stop lets that same instruction through, so
+		// stepping again resumes.
+		bool check(const Z80& cpu);
+
+	private:
+		vector<Breakpoint> list;
+		std::shared_ptr<const SymbolTable> symbols;
+		vector<uint64_t> bits; // by pc, across banks
+		int armed;
+		int nextID;
+		int lastHit;
+		bool resuming;
+		word resumePC;
+		uint32_t resumeClock;
+
+		void rebuild();
+		int findMatch(const Z80& cpu) const;
+	};
+}
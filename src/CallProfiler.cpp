@@ -0,0 +1,216 @@
+#include "CallProfiler.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace GBEmu {
+	CallProfiler::CallProfiler(size_t depth, size_t nodeCount)
+	{
+		maxDepth = depth;
+		maxNodes = nodeCount;
+		reset();
+	}
+
+	void CallProfiler::reset()
+	{
+		stack.clear();
+		nodes.clear();
+		children.clear();
+		overflows = 0;
+
+		nodes.push_back(Node{ 0, ROOT, false, 0, 0 });
+	}
+
+	uint32_t CallProfiler::getChild(uint32_t parent, uint32_t func, bool interrupt)
+	{
+		uint64_t key = (uint64_t(parent) << 32) | func;
+		auto it = children.find(key);
+		if (it != children.end())
+			return it->second;
+
+		// out of room, the rest of this branch goes to its parent
+		if (nodes.size() >= maxNodes)
+			return parent;
+
+		uint32_t node = uint32_t(nodes.size());
+		nodes.push_back(Node{ func, parent, interrupt, 0, 0 });
+		children[key] = node;
+		return node;
+	}
+
+	void CallProfiler::onCall(word bank, word target, word sp, bool interrupt)
+	{
+		if (target < 0x4000 || target >= 0x8000)
+			bank = 0;
+
+		// frames the stack has been unwound past without returning
+		while (!stack.empty() && stack.back().sp <= sp)
+			stack.pop_back();
+
+		if (stack.size() >= maxDepth) {
+			overflows++;
+			stack.clear();
+		}
+
+		uint32_t node = getChild(getCurrent(), (uint32_t(bank) << 16) | target, interrupt);
+		nodes[node].calls++;
+		stack.push_back(Frame{ node, sp });
+	}
+
+	void CallProfiler::onReturn(word sp)
+	{
+		for (size_t i = stack.size(); i > 0; i--) {
+			if (stack[i - 1].sp == sp) {
+				stack.resize(i - 1);
+				return;
+			}
+		}
+
+		// a RET nobody called for, e.g. push + ret as a jump
+	}
+
+	const vector<CallProfiler::Node>& CallProfiler::getNodes() const
+	{
+		return nodes;
+	}
+
+	uint64_t CallProfiler::getOverflows() const
+	{
+		return overflows;
+	}
+
+	vector<uint64_t> CallProfiler::getInclusive() const
+	{
+		vector<uint64_t> inclusive(nodes.size());
+		for (size_t i = 0; i < nodes.size(); i++)
+			inclusive[i] = nodes[i].self;
+
+		// children always come after their parents
+		for (size_t i = nodes.size() - 1; i > 0; i--)
+			inclusive[nodes[i].parent] += inclusive[i];
+
+		return inclusive;
+	}
+
+	bool CallProfiler::isRecursive(uint32_t node) const
+	{
+		for (uint32_t p = nodes[node].parent; node != ROOT && p != ROOT; p = nodes[p].parent) {
+			if (nodes[p].func == nodes[node].func && nodes[p].interrupt == nodes[node].interrupt)
+				return true;
+		}
+
+		return false;
+	}
+
+	vector<std::string> CallProfiler::getNames(const SymbolTable* syms) const
+	{
+		vector<std::string> names(nodes.size());
+		names[ROOT] = "<toplevel>";
+
+		for (size_t i = 1; i < nodes.size(); i++) {
+			word bank = word(nodes[i].func >> 16), addr = word(nodes[i].func & 0xFFFF);
+
+			if (syms)
+				names[i] = syms->format(bank, addr);
+			else {
+				char buf[16];
+				sprintf(buf, "%02X:%04X", bank, addr);
+				names[i] = buf;
+			}
+
+			if (nodes[i].interrupt)
+				names[i] += " [int]";
+		}
+
+		return names;
+	}
+
+	void CallProfiler::exportCallgrind(std::ostream& out, const SymbolTable* syms) const
+	{
+		auto inclusive = getInclusive();
+
+		struct Edge {
+			uint64_t calls;
+			uint64_t inclusive;
+		};
+
+		struct Function {
+			uint64_t self;
+			map<std::string, Edge> callees;
+		};
+
+		// contexts folded into functions
+		auto names = getNames(syms);
+		map<std::string, Function> funcs;
+		for (size_t i = 0; i < nodes.size(); i++) {
+			funcs[names[i]].self += nodes[i].self;
+
+			if (i != ROOT) {
+				Edge& e = funcs[names[nodes[i].parent]].callees[names[i]];
+				e.calls += nodes[i].calls;
+				if (!isRecursive(uint32_t(i)))
+					e.inclusive += inclusive[i];
+			}
+		}
+
+		out << "# callgrind format\n";
+		out << "version: 1\n";
+		out << "creator: gbemu\n";
+		out << "positions: line\n";
+		out << "events: Cycles\n\n";
+
+		for (auto &f : funcs) {
+			out << "fn=" << f.first << "\n";
+			out << "0 " << f.second.self << "\n";
+
+			for (auto &c : f.second.callees) {
+				out << "cfn=" << c.first << "\n";
+				out << "calls=" << c.second.calls << " 0\n";
+				out << "0 " << c.second.inclusive << "\n";
+			}
+
+			out << "\n";
+		}
+
+		out << "totals: " << inclusive[ROOT] << "\n";
+	}
+
+	void CallProfiler::exportText(std::ostream& out, const SymbolTable* syms, size_t top) const
+	{
+		auto inclusive = getInclusive();
+
+		struct Totals {
+			uint64_t inclusive, self, calls;
+		};
+
+		auto names = getNames(syms);
+		map<std::string, Totals> funcs;
+		for (size_t i = 0; i < nodes.size(); i++) {
+			Totals& t = funcs[names[i]];
+			t.self += nodes[i].self;
+			t.calls += nodes[i].calls;
+			if (!isRecursive(uint32_t(i)))
+				t.inclusive += inclusive[i];
+		}
+
+		vector<std::pair<std::string, Totals>> sorted(funcs.begin(), funcs.end());
+		std::stable_sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, Totals>& a, const std::pair<std::string, Totals>& b) {
+			return a.second.inclusive > b.second.inclusive;
+		});
+
+		if (top && sorted.size() > top)
+			sorted.resize(top);
+
+		char line[128];
+		sprintf(line, "%14s %7s %14s %7s %10s  %s\n", "inclusive", "%", "exclusive", "%", "calls", "function");
+		out << line;
+
+		double total = inclusive[ROOT] ? double(inclusive[ROOT]) : 1;
+		for (auto &f : sorted) {
+			sprintf(line, "%14llu %6.2f%% %14llu %6.2f%% %10llu  ",
+				(unsigned long long)f.second.inclusive, 100 * f.second.inclusive / total,
+				(unsigned long long)f.second.self, 100 * f.second.self / total,
+				(unsigned long long)f.second.calls);
+			out << line << f.first << "\n";
+		}
+	}
+}
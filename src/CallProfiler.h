@@ -0,0 +1,77 @@
+#pragma once
+
+#include "types.h"
+#include "SymbolTable.h"
+#include <ostream>
+#include <unordered_map>
+
+namespace GBEmu {
+	// cycles by calling context. the cpu tells us about calls (CALL, RST,
+	// interrupts) and returns, and we keep a shadow of the guest's call stack.
+	//
+	// games don't always return the way they called: some pop the return
+	// address and jump, some reset sp. frames remember the sp they were
+	// called with, so a RET only unwinds to the frame it actually returns from
+	// (and anything abandoned above it), a call that pushes at or above a
+	// frame's sp drops that frame (the stack grows down, so its return address
+	// is gone), and a RET that matches nothing is taken for a jump.
+	class CallProfiler {
+	public:
+		static const uint32_t ROOT = 0;
+
+		struct Node {
+			uint32_t func; // (bank << 16) | addr
+			uint32_t parent;
+			bool interrupt;
+			uint64_t calls;
+			uint64_t self; // cycles
+		};
+
+		CallProfiler(size_t maxDepth = 256, size_t maxNodes = 1 << 20);
+
+		// right after the return address is pushed, sp pointing at it
+		void onCall(word bank, word target, word sp, bool interrupt);
+		// right before the return address is popped
+		void onReturn(word sp);
+
+		// the context the next instruction runs in
+		uint32_t getCurrent() const {
+			return stack.empty() ? ROOT : stack.back().node;
+		}
+
+		void addCycles(uint32_t node, uint32_t cycles) {
+			nodes[node].self += cycles;
+		}
+
+		void reset();
+
+		const vector<Node>& getNodes() const;
+		// times the shadow stack was too deep and started over
+		uint64_t getOverflows() const;
+
+		// callgrind format, for kcachegrind/qcachegrind
+		void exportCallgrind(std::ostream& out, const SymbolTable* syms) const;
+		// inclusive and exclusive cycles per function, most inclusive first
+		void exportText(std::ostream& out, const SymbolTable* syms, size_t top = 0) const;
+
+	private:
+		struct Frame {
+			uint32_t node;
+			word sp;
+		};
+
+		size_t maxDepth, maxNodes;
+		vector<Frame> stack;
+		vector<Node> nodes;
+		// (parent << 32) | func -> child node
+		std::unordered_map<uint64_t, uint32_t> children;
+		uint64_t overflows;
+
+		uint32_t getChild(uint32_t parent, uint32_t func, bool interrupt);
+		vector<uint64_t> getInclusive() const;
+		// the same function is already further up this context, so its
+		// cycles are counted there
+		bool isRecursive(uint32_t node) const;
+		vector<std::string> getNames(const SymbolTable* syms) const;
+	};
+}
@@ -0,0 +1,219 @@
+#include "Coverage.h"
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+
+namespace GBEmu {
+	namespace {
+		struct CoverageHeader {
+			char magic[4]; // "GBCV"
+			uint16_t version;
+			uint16_t bankCount;
+			uint64_t romHash;
+		};
+
+		const uint16_t COVERAGE_VERSION = 1;
+
+		const char* kindNames[COVERAGE_KINDS] = { "exec", "read", "write" };
+
+		size_t countBits(uint64_t v)
+		{
+			size_t n = 0;
+			for (; v; n++)
+				v &= v - 1;
+			return n;
+		}
+
+		size_t countBits(const uint64_t* words, size_t count)
+		{
+			size_t n = 0;
+			for (size_t i = 0; i < count; i++)
+				n += countBits(words[i]);
+			return n;
+		}
+
+		// "kind bank:from-to" for every run of set bits
+		void writeRanges(std::ostream& out, const char* kind, const char* bank, const uint64_t* bits, size_t bytes, word base)
+		{
+			size_t i = 0;
+			while (i < bytes) {
+				if (!(bits[i >> 6] >> (i & 63) & 1)) {
+					i++;
+					continue;
+				}
+
+				size_t from = i;
+				while (i < bytes && (bits[i >> 6] >> (i & 63) & 1))
+					i++;
+
+				char line[48];
+				sprintf(line, "%s %s%04x-%04x\n", kind, bank, unsigned(base + from), unsigned(base + i - 1));
+				out << line;
+			}
+		}
+	}
+
+	Coverage::Coverage(uint64_t romHash)
+		: romHash(romHash)
+	{
+		reset();
+	}
+
+	void Coverage::addBank(word bank)
+	{
+		// every bank up to this one, so an index under size() is always there
+		banks.resize(bank + 1, vector<uint64_t>(COVERAGE_KINDS * BANK_WORDS, 0));
+	}
+
+	void Coverage::reset()
+	{
+		banks.clear();
+		ram.assign(COVERAGE_KINDS * RAM_WORDS, 0);
+	}
+
+	bool Coverage::isMarked(COVERAGE_KIND kind, word bank, word addr) const
+	{
+		if (addr >= 0x8000) {
+			addr -= 0x8000;
+			return ram[kind * RAM_WORDS + (addr >> 6)] >> (addr & 63) & 1;
+		}
+
+		if (addr < 0x4000)
+			bank = 0;
+		else
+			addr -= 0x4000;
+
+		if (bank >= banks.size())
+			return false;
+
+		return banks[bank][kind * BANK_WORDS + (addr >> 6)] >> (addr & 63) & 1;
+	}
+
+	size_t Coverage::getCount(COVERAGE_KIND kind, word bank) const
+	{
+		if (bank >= banks.size())
+			return 0;
+		return countBits(&banks[bank][kind * BANK_WORDS], BANK_WORDS);
+	}
+
+	size_t Coverage::getRAMCount(COVERAGE_KIND kind) const
+	{
+		return countBits(&ram[kind * RAM_WORDS], RAM_WORDS);
+	}
+
+	size_t Coverage::getBankCount() const
+	{
+		return banks.size();
+	}
+
+	uint64_t Coverage::getROMHash() const
+	{
+		return romHash;
+	}
+
+	void Coverage::merge(const Coverage& other)
+	{
+		if (other.romHash != romHash)
+			throw std::runtime_error("coverage is for a different rom");
+
+		if (other.banks.size() > banks.size())
+			addBank(word(other.banks.size() - 1));
+
+		for (size_t b = 0; b < other.banks.size(); b++) {
+			for (size_t i = 0; i < COVERAGE_KINDS * BANK_WORDS; i++)
+				banks[b][i] |= other.banks[b][i];
+		}
+
+		for (size_t i = 0; i < ram.size(); i++)
+			ram[i] |= other.ram[i];
+	}
+
+	void Coverage::save(const std::string& filename) const
+	{
+		std::ofstream out(filename, std::ios::out | std::ios::binary);
+		if (!out.is_open())
+			throw std::runtime_error("could not write " + filename);
+
+		CoverageHeader header = { { 'G', 'B', 'C', 'V' }, COVERAGE_VERSION, uint16_t(banks.size()), romHash };
+		out.write((const char*)&header, sizeof(header));
+		for (auto &bank : banks)
+			out.write((const char*)bank.data(), bank.size() * sizeof(uint64_t));
+		out.write((const char*)ram.data(), ram.size() * sizeof(uint64_t));
+	}
+
+	void Coverage::load(const std::string& filename)
+	{
+		std::ifstream in(filename, std::ios::in | std::ios::binary);
+		if (!in.is_open())
+			throw std::runtime_error("coverage file " + filename + " could not be opened");
+
+		CoverageHeader header;
+		if (!in.read((char*)&header, sizeof(header)) || memcmp(header.magic, "GBCV", 4))
+			throw std::runtime_error(filename + " is not a coverage file");
+		if (header.version != COVERAGE_VERSION)
+			throw std::runtime_error(filename + " is coverage version " + std::to_string(header.version));
+
+		vector<vector<uint64_t>> b(header.bankCount, vector<uint64_t>(COVERAGE_KINDS * BANK_WORDS));
+		vector<uint64_t> r(COVERAGE_KINDS * RAM_WORDS);
+		for (auto &bank : b) {
+			if (!in.read((char*)bank.data(), bank.size() * sizeof(uint64_t)))
+				throw std::runtime_error(filename + " ends too soon");
+		}
+		if (!in.read((char*)r.data(), r.size() * sizeof(uint64_t)))
+			throw std::runtime_error(filename + " ends too soon");
+
+		romHash = header.romHash;
+		banks.swap(b);
+		ram.swap(r);
+	}
+
+	void Coverage::exportText(std::ostream& out, bool ranges) const
+	{
+		char line[96];
+		size_t totals[COVERAGE_KINDS] = {};
+
+		sprintf(line, "rom %016llx, %d banks seen\n", (unsigned long long)romHash, int(banks.size()));
+		out << line;
+
+		for (size_t b = 0; b < banks.size(); b++) {
+			size_t counts[COVERAGE_KINDS];
+			for (int k = 0; k < COVERAGE_KINDS; k++) {
+				counts[k] = getCount(COVERAGE_KIND(k), word(b));
+				totals[k] += counts[k];
+			}
+
+			if (!counts[COVERAGE_EXEC] && !counts[COVERAGE_READ] && !counts[COVERAGE_WRITE])
+				continue;
+
+			// run or read as data, the part of the bank that's known to matter
+			size_t used = 0;
+			for (size_t i = 0; i < BANK_WORDS; i++)
+				used += countBits(banks[b][COVERAGE_EXEC * BANK_WORDS + i] | banks[b][COVERAGE_READ * BANK_WORDS + i]);
+
+			sprintf(line, "bank %02x  exec %5d  read %5d  write %5d  (%.1f%% used)\n", int(b),
+				int(counts[COVERAGE_EXEC]), int(counts[COVERAGE_READ]), int(counts[COVERAGE_WRITE]),
+				100.0 * used / BANK_BYTES);
+			out << line;
+		}
+
+		sprintf(line, "rom      exec %5d  read %5d  write %5d\n",
+			int(totals[COVERAGE_EXEC]), int(totals[COVERAGE_READ]), int(totals[COVERAGE_WRITE]));
+		out << line;
+		sprintf(line, "ram      exec %5d  read %5d  write %5d\n",
+			int(getRAMCount(COVERAGE_EXEC)), int(getRAMCount(COVERAGE_READ)), int(getRAMCount(COVERAGE_WRITE)));
+		out << line;
+
+		if (!ranges)
+			return;
+
+		for (int k = 0; k < COVERAGE_KINDS; k++) {
+			for (size_t b = 0; b < banks.size(); b++) {
+				char bank[8];
+				sprintf(bank, "%02x:", int(b));
+				writeRanges(out, kindNames[k], bank, &banks[b][k * BANK_WORDS], BANK_BYTES, b ? 0x4000 : 0);
+			}
+			writeRanges(out, kindNames[k], "", &ram[k * RAM_WORDS], RAM_BYTES, 0x8000);
+		}
+	}
+}
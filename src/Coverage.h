@@ -0,0 +1,78 @@
+#pragma once
+
+#include "types.h"
+#include <ostream>
+
+namespace GBEmu {
+	enum COVERAGE_KIND {
+		COVERAGE_EXEC, // fetched as part of an instruction, operands too
+		COVERAGE_READ, // read as data
+		COVERAGE_WRITE,
+		COVERAGE_KINDS
+	};
+
+	// one bit per byte for each kind of access. the rom is kept per bank,
+	// 0x0000-0x3FFF being bank 0, and everything from 0x8000 up by address.
+	// marking is a single or into a flat array, cheap enough for long runs.
+	//
+	// files from separate runs of the same rom can be merged in any order,
+	// so each run can write its own and they get or'ed together afterwards.
+	class Coverage {
+		static const size_t BANK_BYTES = 0x4000;
+		static const size_t RAM_BYTES = 0x8000;
+		static const size_t BANK_WORDS = BANK_BYTES / 64;
+		static const size_t RAM_WORDS = RAM_BYTES / 64;
+
+		// [bank][kind * BANK_WORDS + offset / 64], made as banks show up
+		vector<vector<uint64_t>> banks;
+		// [kind * RAM_WORDS + (addr - 0x8000) / 64]
+		vector<uint64_t> ram;
+		uint64_t romHash;
+
+	public:
+		// romHash is ROM::gethash(), files for other roms won't merge
+		Coverage(uint64_t romHash = 0);
+
+		// bank is only looked at for romx
+		void mark(COVERAGE_KIND kind, word bank, word addr) {
+			if (addr >= 0x8000) {
+				addr -= 0x8000;
+				ram[kind * RAM_WORDS + (addr >> 6)] |= 1ull << (addr & 63);
+				return;
+			}
+
+			if (addr < 0x4000)
+				bank = 0;
+			else
+				addr -= 0x4000;
+
+			if (bank >= banks.size())
+				addBank(bank);
+
+			banks[bank][kind * BANK_WORDS + (addr >> 6)] |= 1ull << (addr & 63);
+		}
+
+		bool isMarked(COVERAGE_KIND kind, word bank, word addr) const;
+		// bytes of the bank with the bit set
+		size_t getCount(COVERAGE_KIND kind, word bank) const;
+		size_t getRAMCount(COVERAGE_KIND kind) const;
+		size_t getBankCount() const;
+		uint64_t getROMHash() const;
+
+		void reset();
+
+		// or's other in. throws if it's for a different rom.
+		void merge(const Coverage& other);
+
+		void save(const std::string& filename) const;
+		// replaces what's here, throws on a bad file
+		void load(const std::string& filename);
+
+		// bytes covered per bank, then with ranges the covered runs as
+		// "exec 01:4000-40ff" lines, which diff well between runs.
+		void exportText(std::ostream& out, bool ranges) const;
+
+	private:
+		void addBank(word bank);
+	};
+}
@@ -0,0 +1,416 @@
+#include "Disassembler.h"
+#include <fstream>
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+
+namespace GBEmu {
+	namespace {
+		// n is a byte operand, w a word, e a relative jump. 0x40-0xBF and the
+		// cb ones follow a pattern and are made on the fly.
+		const char* mnemonics[256] = {
+			// 0x00
+			"NOP", "LD BC, w", "LD (BC), A", "INC BC", "INC B", "DEC B", "LD B, n", "RLCA",
+			"LD (w), SP", "ADD HL, BC", "LD A, (BC)", "DEC BC", "INC C", "DEC C", "LD C, n", "RRCA",
+			// 0x10
+			"STOP", "LD DE, w", "LD (DE), A", "INC DE", "INC D", "DEC D", "LD D, n", "RLA",
+			"JR e", "ADD HL, DE", "LD A, (DE)", "DEC DE", "INC E", "DEC E", "LD E, n", "RRA",
+			// 0x20
+			"JR NZ, e", "LD HL, w", "LD (HL+), A", "INC HL", "INC H", "DEC H", "LD H, n", "DAA",
+			"JR Z, e", "ADD HL, HL", "LD A, (HL+)", "DEC HL", "INC L", "DEC L", "LD L, n", "CPL",
+			// 0x30
+			"JR NC, e", "LD SP, w", "LD (HL-), A", "INC SP", "INC (HL)", "DEC (HL)", "LD (HL), n", "SCF",
+			"JR C, e", "ADD HL, SP", "LD A, (HL-)", "DEC SP", "INC A", "DEC A", "LD A, n", "CCF",
+			// 0x40 -> 0xBF
+			0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+			0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+			0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+			0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+			0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+			0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+			0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+			0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+			// 0xC0
+			"RET NZ", "POP BC", "JP NZ, w", "JP w", "CALL NZ, w", "PUSH BC", "ADD A, n", "RST $00",
+			"RET Z", "RET", "JP Z, w", "PREFIX CB", "CALL Z, w", "CALL w", "ADC A, n", "RST $08",
+			// 0xD0
+			"RET NC", "POP DE", "JP NC, w", 0, "CALL NC, w", "PUSH DE", "SUB n", "RST $10",
+			"RET C", "RETI", "JP C, w", 0, "CALL C, w", 0, "SBC A, n", "RST $18",
+			// 0xE0
+			"LDH ($FF00+n), A", "POP HL", "LD ($FF00+C), A", 0, 0, "PUSH HL", "AND n", "RST $20",
+			"ADD SP, n", "JP (HL)", "LD (w), A", 0, 0, 0, "XOR n", "RST $28",
+			// 0xF0
+			"LDH A, ($FF00+n)", "POP AF", "LD A, ($FF00+C)", "DI", 0, "PUSH AF", "OR n", "RST $30",
+			"LD HL, SP+n", "LD SP, HL", "LD A, (w)", "EI", 0, 0, "CP n", "RST $38"
+		};
+
+		const char* regNames[8] = { "B", "C", "D", "E", "H", "L", "(HL)", "A" };
+		const char* aluNames[8] = { "ADD A, ", "ADC A, ", "SUB ", "SBC A, ", "AND ", "XOR ", "OR ", "CP " };
+		const char* cbNames[8] = { "RLC ", "RRC ", "RL ", "RR ", "SLA ", "SRA ", "SWAP ", "SRL " };
+
+		std::string getMnemonic(byte op)
+		{
+			if (op == 0x76)
+				return "HALT";
+			if (op >= 0x40 && op < 0x80)
+				return std::string("LD ") + regNames[(op >> 3) & 7] + ", " + regNames[op & 7];
+			if (op >= 0x80 && op < 0xC0)
+				return std::string(aluNames[(op >> 3) & 7]) + regNames[op & 7];
+			return mnemonics[op] ? mnemonics[op] : "";
+		}
+
+		std::string getCBMnemonic(byte op)
+		{
+			const char* bitNames[4] = { 0, "BIT ", "RES ", "SET " };
+			if (op < 0x40)
+				return std::string(cbNames[op >> 3]) + regNames[op & 7];
+			return std::string(bitNames[op >> 6]) + char('0' + ((op >> 3) & 7)) + ", " + regNames[op & 7];
+		}
+
+		enum FLOW {
+			FLOW_NEXT,
+			FLOW_JUMP, // and doesn't come back
+			FLOW_BRANCH, // conditional jump
+			FLOW_CALL,
+			FLOW_END // ret, jp (hl), or not code
+		};
+
+		FLOW getFlow(byte op)
+		{
+			switch (op) {
+			case 0x18: case 0xC3:
+				return FLOW_JUMP;
+			case 0x20: case 0x28: case 0x30: case 0x38:
+			case 0xC2: case 0xCA: case 0xD2: case 0xDA:
+				return FLOW_BRANCH;
+			case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:
+			case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+				return FLOW_CALL;
+			case 0xC9: case 0xD9: case 0xE9:
+				return FLOW_END;
+			}
+
+			return mnemonics[op] || (op >= 0x40 && op < 0xC0) ? FLOW_NEXT : FLOW_END;
+		}
+
+		bool isRelative(byte op)
+		{
+			return op == 0x18 || op == 0x20 || op == 0x28 || op == 0x30 || op == 0x38;
+		}
+
+		bool isRST(byte op)
+		{
+			return (op & 0xC7) == 0xC7;
+		}
+
+		// the bank's window, see CodeIndex
+		bool inBank(word bank, word addr)
+		{
+			return bank == 0 ? addr < 0x4000 : addr >= 0x4000 && addr < 0x8000;
+		}
+
+		byte readAt(ROM& rom, word bank, word addr)
+		{
+			return addr < 0x4000 ? rom.readBank(0, addr) : rom.readBank(byte(bank), addr - 0x4000);
+		}
+
+		struct IndexHeader {
+			char magic[4]; // "GBIX"
+			uint16_t version;
+			uint16_t bankCount;
+			uint64_t romHash;
+			uint32_t xrefCount;
+			uint32_t reserved;
+		};
+
+		const uint16_t INDEX_VERSION = 1;
+		const size_t BANK_WORDS = 0x4000 / 64;
+	}
+
+	int getInstructionLength(byte op)
+	{
+		if (op == 0xCB || op == 0x10)
+			return 2;
+
+		std::string m = getMnemonic(op);
+		if (m.find('w') != std::string::npos)
+			return 3;
+		if (m.find('n') != std::string::npos || m.find('e') != std::string::npos)
+			return 2;
+		return 1;
+	}
+
+	std::string disassemble(const byte* bytes, word addr)
+	{
+		if (bytes[0] == 0xCB)
+			return getCBMnemonic(bytes[1]);
+
+		std::string m = getMnemonic(bytes[0]);
+		if (m.empty()) {
+			char buf[16];
+			sprintf(buf, "DB $%02X", bytes[0]);
+			return buf;
+		}
+
+		// the operand letters are lowercase, nothing else is
+		char buf[8];
+		size_t i;
+		if ((i = m.find('n')) != std::string::npos) {
+			sprintf(buf, "$%02X", bytes[1]);
+			m.replace(i, 1, buf);
+		}
+		else if ((i = m.find('w')) != std::string::npos) {
+			sprintf(buf, "$%04X", packWord(bytes[2], bytes[1]));
+			m.replace(i, 1, buf);
+		}
+		else if ((i = m.find('e')) != std::string::npos) {
+			sprintf(buf, "$%04X", word(addr + 2 + int8_t(bytes[1])));
+			m.replace(i, 1, buf);
+		}
+
+		return m;
+	}
+
+	CodeIndex::CodeIndex()
+	{
+		romHash = 0;
+	}
+
+	void CodeIndex::mark(word bank, word addr)
+	{
+		word bit = addr & 0x3FFF;
+		starts[bank][bit >> 6] |= uint64_t(1) << (bit & 63);
+	}
+
+	bool CodeIndex::isInstruction(word bank, word addr) const
+	{
+		if (addr >= 0x8000)
+			return false;
+		if (addr < 0x4000)
+			bank = 0;
+		if (bank >= starts.size())
+			return false;
+
+		word bit = addr & 0x3FFF;
+		return (starts[bank][bit >> 6] >> (bit & 63)) & 1;
+	}
+
+	void CodeIndex::build(ROM& rom)
+	{
+		struct Pending {
+			word bank, addr;
+			int switchedTo; // the bank bank 0 code thinks is at 0x4000, or -1
+		};
+
+		size_t banks = std::max<size_t>(2, rom.getbankcount());
+		romHash = rom.gethash();
+		starts.assign(banks, vector<uint64_t>(BANK_WORDS, 0));
+		xrefs.clear();
+
+		vector<Pending> work;
+		work.push_back(Pending{ 0, 0x100, -1 });
+		for (word v = 0; v <= 0x38; v += 8)
+			work.push_back(Pending{ 0, v, -1 });
+		for (word v = 0x40; v <= 0x60; v += 8)
+			work.push_back(Pending{ 0, v, -1 });
+
+		while (!work.empty()) {
+			Pending p = work.back();
+			work.pop_back();
+
+			word addr = p.addr;
+			int switchedTo = p.switchedTo;
+			int lastA = -1; // the n of a "LD A, n" just before
+
+			while (inBank(p.bank, addr) && !isInstruction(p.bank, addr)) {
+				byte bytes[3];
+				for (int i = 0; i < 3; i++)
+					bytes[i] = readAt(rom, p.bank, addr + i);
+
+				byte op = bytes[0];
+				int len = getInstructionLength(op);
+				FLOW flow = getFlow(op);
+				mark(p.bank, addr);
+
+				// LD (w), A into the mbc's bank register
+				word dest = packWord(bytes[2], bytes[1]);
+				if (op == 0xEA && dest >= 0x2000 && dest < 0x4000 && lastA >= 0)
+					switchedTo = lastA ? lastA : 1;
+				lastA = op == 0x3E ? bytes[1] : -1;
+
+				if (flow == FLOW_JUMP || flow == FLOW_BRANCH || flow == FLOW_CALL) {
+					word target = isRelative(op) ? word(addr + 2 + int8_t(bytes[1])) :
+						isRST(op) ? word(op & 0x38) : dest;
+
+					word toBank = 0;
+					if (target >= 0x4000 && target < 0x8000) {
+						if (p.bank)
+							toBank = p.bank;
+						else if (switchedTo >= 0)
+							toBank = word(switchedTo);
+						else
+							toBank = banks == 2 ? 1 : BANK_UNKNOWN;
+					}
+
+					xrefs.push_back(Xref{ p.bank, addr, toBank, target, byte(flow == FLOW_CALL ? XREF_CALL : XREF_JUMP), 0 });
+
+					// banked code still has its own bank in when it calls down
+					if (target < 0x8000 && toBank < banks)
+						work.push_back(Pending{ toBank, target, p.bank ? int(p.bank) : switchedTo });
+				}
+
+				if (flow == FLOW_JUMP || flow == FLOW_END)
+					break;
+				addr += len;
+			}
+		}
+
+		std::sort(xrefs.begin(), xrefs.end(), [](const Xref& a, const Xref& b) {
+			if (a.toBank != b.toBank) return a.toBank < b.toBank;
+			if (a.to != b.to) return a.to < b.to;
+			if (a.fromBank != b.fromBank) return a.fromBank < b.fromBank;
+			return a.from < b.from;
+		});
+	}
+
+	void CodeIndex::save(const std::string& filename) const
+	{
+		std::ofstream out(filename, std::ios::out | std::ios::binary);
+		if (!out.is_open())
+			throw std::runtime_error("could not write " + filename);
+
+		IndexHeader header = { { 'G', 'B', 'I', 'X' }, INDEX_VERSION, uint16_t(starts.size()), romHash, uint32_t(xrefs.size()), 0 };
+		out.write((const char*)&header, sizeof(header));
+		for (auto &bank : starts)
+			out.write((const char*)bank.data(), BANK_WORDS * sizeof(uint64_t));
+		out.write((const char*)xrefs.data(), xrefs.size() * sizeof(Xref));
+	}
+
+	bool CodeIndex::load(const std::string& filename, uint64_t hash)
+	{
+		std::ifstream in(filename, std::ios::in | std::ios::binary);
+		if (!in.is_open())
+			return false;
+
+		IndexHeader header;
+		if (!in.read((char*)&header, sizeof(header)) || memcmp(header.magic, "GBIX", 4) ||
+			header.version != INDEX_VERSION || header.romHash != hash)
+			return false;
+
+		vector<vector<uint64_t>> banks(header.bankCount, vector<uint64_t>(BANK_WORDS));
+		for (auto &bank : banks) {
+			if (!in.read((char*)bank.data(), BANK_WORDS * sizeof(uint64_t)))
+				return false;
+		}
+
+		vector<Xref> refs(header.xrefCount);
+		if (!in.read((char*)refs.data(), refs.size() * sizeof(Xref)))
+			return false;
+
+		romHash = hash;
+		starts.swap(banks);
+		xrefs.swap(refs);
+		return true;
+	}
+
+	void CodeIndex::loadOrBuild(ROM& rom, const std::string& cacheDir)
+	{
+		char name[32];
+		sprintf(name, "%016llx.gbidx", (unsigned long long)rom.gethash());
+		std::string path = cacheDir.empty() ? name : cacheDir + "/" + name;
+
+		if (load(path, rom.gethash()))
+			return;
+
+		build(rom);
+
+		// it's only a cache, an index that can't be kept is still good for now
+		try {
+			save(path);
+		}
+		catch (const std::runtime_error&) {
+		}
+	}
+
+	size_t CodeIndex::getInstructionCount() const
+	{
+		size_t count = 0;
+		for (auto &bank : starts) {
+			for (auto bits : bank)
+				count += std::bitset<64>(bits).count();
+		}
+		return count;
+	}
+
+	size_t CodeIndex::getBankCount() const
+	{
+		return starts.size();
+	}
+
+	const vector<Xref>& CodeIndex::getXrefs() const
+	{
+		return xrefs;
+	}
+
+	vector<Xref> CodeIndex::getXrefsTo(word bank, word addr) const
+	{
+		if (addr < 0x4000)
+			bank = 0;
+
+		Xref key = { 0, 0, bank, addr, 0, 0 };
+		auto range = std::equal_range(xrefs.begin(), xrefs.end(), key, [](const Xref& a, const Xref& b) {
+			return a.toBank != b.toBank ? a.toBank < b.toBank : a.to < b.to;
+		});
+
+		return vector<Xref>(range.first, range.second);
+	}
+
+	void CodeIndex::exportListing(ROM& rom, std::ostream& out, const SymbolTable* syms) const
+	{
+		char line[96];
+
+		for (word bank = 0; bank < starts.size(); bank++) {
+			word base = bank ? 0x4000 : 0;
+			word covered = base; // past the last instruction listed
+
+			sprintf(line, "; bank %02X\n", bank);
+			out << line;
+
+			for (word addr = base; addr < base + 0x4000; addr++) {
+				if (!isInstruction(bank, addr))
+					continue;
+
+				std::string name;
+				word offset;
+				if (syms && syms->lookup(bank, addr, name, offset) && !offset)
+					out << name << ":\n";
+				else if (addr != covered)
+					out << "\n";
+
+				byte bytes[3];
+				for (int i = 0; i < 3; i++)
+					bytes[i] = readAt(rom, bank, addr + i);
+				int len = getInstructionLength(bytes[0]);
+				covered = addr + len;
+
+				char hex[12] = "";
+				for (int i = 0; i < len; i++)
+					sprintf(hex + i * 3, "%02X ", bytes[i]);
+
+				auto refs = getXrefsTo(bank, addr);
+				sprintf(line, refs.empty() ? "%02X:%04X  %-9s %s" : "%02X:%04X  %-9s %-20s", bank, addr, hex, disassemble(bytes, addr).c_str());
+				out << line;
+
+				for (size_t i = 0; i < refs.size() && i < 3; i++) {
+					sprintf(line, "%s%s %02X:%04X", i ? "," : " ;", refs[i].kind == XREF_CALL ? " call" : " jump", refs[i].fromBank, refs[i].from);
+					out << line;
+				}
+				if (refs.size() > 3)
+					out << " +" << refs.size() - 3;
+				out << "\n";
+			}
+		}
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "types.h"
+#include "ROM.h"
+#include "SymbolTable.h"
+#include <string>
+#include <ostream>
+
+namespace GBEmu {
+	// "LD A, $12", "JR NZ, $0150". bytes is the opcode and the two after it,
+	// addr where it sits, for relative jumps.
+	std::string disassemble(const byte* bytes, word addr);
+	// 1 to 3, cb-prefixed ones are 2
+	int getInstructionLength(byte opcode);
+
+	enum XREF_KIND : byte {
+		XREF_JUMP, // jp and jr, taken or not
+		XREF_CALL // call and rst
+	};
+
+	// for targets in 0x4000-0x7FFF we couldn't tell the bank of
+	const word BANK_UNKNOWN = 0xFFFF;
+
+	struct Xref {
+		word fromBank, from;
+		word toBank, to;
+		byte kind; // XREF_KIND
+		byte reserved;
+	};
+
+	static_assert(sizeof(Xref) == 10, "index files depend on the xref layout");
+
+	// where the code in a rom is, found by walking it from the entry points
+	// (0x100, the rst and interrupt vectors) and following every jump and
+	// call. bank 0 is 0x0000-0x3FFF, other banks are 0x4000-0x7FFF.
+	//
+	// code in bank 0 calling into 0x4000-0x7FFF could mean any bank. a
+	// "LD A, n" right before a write to 0x2000-0x3FFF is taken as switching
+	// to bank n, and roms with only two banks can only mean bank 1. other
+	// targets get BANK_UNKNOWN and aren't followed. neither is anything
+	// outside the rom, or jp (hl).
+	class CodeIndex {
+	public:
+		CodeIndex();
+
+		void build(ROM& rom);
+		// from cacheDir/<rom hash>.gbidx if it's there and current, otherwise
+		// build and try to save it there. not being able to write it isn't
+		// an error.
+		void loadOrBuild(ROM& rom, const std::string& cacheDir);
+
+		void save(const std::string& filename) const;
+		// false if it's missing or for another rom
+		bool load(const std::string& filename, uint64_t romHash);
+
+		// an instruction starts here
+		bool isInstruction(word bank, word addr) const;
+		size_t getInstructionCount() const;
+		size_t getBankCount() const;
+
+		// sorted by target
+		const vector<Xref>& getXrefs() const;
+		vector<Xref> getXrefsTo(word bank, word addr) const;
+
+		// everything found, bank by bank, labelled from syms when given
+		void exportListing(ROM& rom, std::ostream& out, const SymbolTable* syms) const;
+
+	private:
+		uint64_t romHash;
+		// per bank, a bit per byte
+		vector<vector<uint64_t>> starts;
+		vector<Xref> xrefs;
+
+		void mark(word bank, word addr);
+	};
+}
@@ -0,0 +1,170 @@
+#include "ExecTrace.h"
+#include "Disassembler.h"
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+
+namespace GBEmu {
+	// file layout, little endian as written by the host:
+	//   header, then count records oldest first
+	struct TraceHeader {
+		char magic[4]; // "GBXT"
+		uint16_t version;
+		uint16_t recordSize;
+		uint32_t count;
+		uint32_t every; // sampling
+	};
+
+	static const uint16_t TRACE_VERSION = 1;
+
+	ExecTrace::ExecTrace(size_t capacity)
+	{
+		if (capacity == 0)
+			throw std::runtime_error("an execution trace needs room for at least one record");
+
+		ring.resize(capacity);
+		every = 1;
+		hasTrigger = false;
+		after = 0;
+		clear();
+	}
+
+	void ExecTrace::setSampling(uint32_t n)
+	{
+		every = n ? n : 1;
+		countdown = every;
+	}
+
+	void ExecTrace::setTrigger(word bank, word pc, size_t afterCount)
+	{
+		hasTrigger = true;
+		triggerAnyBank = pc < 0x4000 || pc >= 0x8000 || bank == BANK_ANY;
+		triggerBank = bank;
+		triggerPC = pc;
+		after = afterCount;
+	}
+
+	void ExecTrace::trigger()
+	{
+		if (triggered)
+			return;
+
+		triggered = true;
+		remaining = after;
+		if (!remaining)
+			stopped = true;
+	}
+
+	void ExecTrace::record(const TraceRecord& rec)
+	{
+		TraceRecord& r = ring[next];
+		r = rec;
+
+		if (flagNext) {
+			r.flags |= TRACE_TRIGGER;
+			flagNext = false;
+		}
+		else if (triggered && !stopped && --remaining == 0)
+			stopped = true;
+
+		if (++next == ring.size())
+			next = 0;
+		if (count < ring.size())
+			count++;
+	}
+
+	void ExecTrace::clear()
+	{
+		next = 0;
+		count = 0;
+		countdown = every;
+		triggered = false;
+		stopped = false;
+		flagNext = false;
+		remaining = 0;
+	}
+
+	bool ExecTrace::isStopped() const
+	{
+		return stopped;
+	}
+
+	size_t ExecTrace::size() const
+	{
+		return count;
+	}
+
+	vector<TraceRecord> ExecTrace::getRecords() const
+	{
+		vector<TraceRecord> out;
+		out.reserve(count);
+
+		size_t first = count < ring.size() ? 0 : next;
+		for (size_t i = 0; i < count; i++)
+			out.push_back(ring[(first + i) % ring.size()]);
+
+		return out;
+	}
+
+	void ExecTrace::save(const std::string& filename) const
+	{
+		std::ofstream out(filename, std::ios::out | std::ios::binary);
+		if (!out.is_open())
+			throw std::runtime_error("could not write " + filename);
+
+		TraceHeader header = { { 'G', 'B', 'X', 'T' }, TRACE_VERSION, sizeof(TraceRecord), uint32_t(count), every };
+		out.write((const char*)&header, sizeof(header));
+
+		// the ring in at most two pieces
+		size_t first = count < ring.size() ? 0 : next;
+		size_t tail = std::min(count, ring.size() - first);
+		out.write((const char*)&ring[first], tail * sizeof(TraceRecord));
+		out.write((const char*)&ring[0], (count - tail) * sizeof(TraceRecord));
+	}
+
+	std::string ExecTrace::formatRecord(const TraceRecord& rec, const SymbolTable* syms)
+	{
+		std::string desc = disassemble(rec.op, rec.pc);
+
+		char line[160];
+		sprintf(line, "%10u %02x:%04x  %-20s AF=%02x%02x BC=%02x%02x DE=%02x%02x HL=%02x%02x SP=%04x%s",
+			rec.cycle, rec.bank, rec.pc, desc.c_str(),
+			rec.a, rec.f, rec.b, rec.c, rec.d, rec.e, rec.h, rec.l, rec.sp,
+			(rec.flags & TRACE_TRIGGER) ? "  <- trigger" : "");
+
+		std::string out = line;
+		std::string label;
+		word offset;
+		if (syms && syms->lookup(rec.bank, rec.pc, label, offset))
+			out += "  ; " + (offset ? label + "+" + std::to_string(offset) : label);
+
+		return out;
+	}
+
+	void ExecTrace::decode(const std::string& filename, std::ostream& out, const SymbolTable* syms)
+	{
+		std::ifstream in(filename, std::ios::in | std::ios::binary);
+		if (!in.is_open())
+			throw std::runtime_error("execution trace " + filename + " could not be opened");
+
+		TraceHeader header;
+		if (!in.read((char*)&header, sizeof(header)) || memcmp(header.magic, "GBXT", 4))
+			throw std::runtime_error(filename + " is not an execution trace");
+		if (header.version != TRACE_VERSION || header.recordSize != sizeof(TraceRecord))
+			throw std::runtime_error(filename + " is from an incompatible version");
+
+		out << "# " << header.count << " records";
+		if (header.every > 1)
+			out << ", 1 in " << header.every << " instructions";
+		out << "\n";
+
+		TraceRecord rec;
+		for (uint32_t i = 0; i < header.count; i++) {
+			if (!in.read((char*)&rec, sizeof(rec)))
+				throw std::runtime_error(filename + " is cut short");
+			out << formatRecord(rec, syms) << "\n";
+		}
+	}
+}
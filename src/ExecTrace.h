@@ -0,0 +1,89 @@
+#pragma once
+
+#include "types.h"
+#include "SymbolTable.h"
+#include <string>
+#include <ostream>
+
+namespace GBEmu {
+	// one executed instruction, as the cpu was right before running it
+	struct TraceRecord {
+		uint32_t cycle; // clock.machine, wraps
+		word bank;
+		word pc;
+		word sp;
+		byte a, f, b, c, d, e, h, l;
+		byte op[3]; // the opcode and the two bytes after it
+		byte flags; // TRACE_*
+		byte reserved[2];
+	};
+
+	static_assert(sizeof(TraceRecord) == 24, "trace files depend on the record layout");
+
+	enum {
+		// the instruction the trigger went off on
+		TRACE_TRIGGER = 0x01
+	};
+
+	// binary execution trace. records go into a ring in memory, so the last
+	// capacity instructions are always there, and are written out in one go.
+	// with sampling only every Nth instruction is kept. with a trigger, the
+	// ring keeps running until the trigger pc (or trigger()) and then records
+	// `after` more before it stops, leaving a window around the event.
+	class ExecTrace {
+	public:
+		ExecTrace(size_t capacity = 1 << 20);
+
+		// keep 1 in every instructions
+		void setSampling(uint32_t every);
+		// stop `after` records past the first time pc runs. bank is only
+		// looked at for romx, and can be BANK_ANY.
+		void setTrigger(word bank, word pc, size_t after);
+		// set it off from anywhere else, e.g. a write hook
+		void trigger();
+
+		// called for every instruction, true if this one should be recorded.
+		// the trigger pc is looked for on every one, sampled or not, and
+		// always gets recorded.
+		bool sample(word pc, word bank) {
+			if (stopped)
+				return false;
+			if (hasTrigger && !triggered && pc == triggerPC && (triggerAnyBank || bank == triggerBank)) {
+				trigger();
+				flagNext = true;
+				countdown = every;
+				return true;
+			}
+			if (--countdown)
+				return false;
+			countdown = every;
+			return true;
+		}
+
+		void record(const TraceRecord& rec);
+
+		void clear();
+		bool isStopped() const;
+		size_t size() const;
+		// oldest first
+		vector<TraceRecord> getRecords() const;
+
+		// header and records, see ExecTrace.cpp
+		void save(const std::string& filename) const;
+		// turns a saved trace into one line per record
+		static void decode(const std::string& filename, std::ostream& out, const SymbolTable* syms);
+		static std::string formatRecord(const TraceRecord& rec, const SymbolTable* syms);
+
+	private:
+		vector<TraceRecord> ring;
+		size_t next, count;
+		uint32_t every, countdown;
+
+		bool hasTrigger, triggered, stopped;
+		// the next record is the one the trigger went off on
+		bool flagNext;
+		bool triggerAnyBank;
+		word triggerBank, triggerPC;
+		size_t after, remaining;
+	};
+}
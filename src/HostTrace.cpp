@@ -0,0 +1,158 @@
+#include "HostTrace.h"
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <stdexcept>
+#include <cstdio>
+
+namespace GBEmu {
+	namespace {
+		struct TraceEvent {
+			const char* name;
+			uint64_t start;
+			uint64_t end;
+		};
+
+		struct ThreadTrace {
+			uint32_t tid;
+			std::string name;
+			vector<TraceEvent> ring;
+			// total ever logged. the ring holds the last ring.size() of them
+			std::atomic<uint64_t> written;
+		};
+
+		std::atomic<bool> enabled(false);
+		std::atomic<size_t> ringSize(0x10000);
+
+		// kept around after their threads are gone, so their events can be exported
+		std::mutex registryLock;
+		vector<std::shared_ptr<ThreadTrace>> registry;
+
+		thread_local ThreadTrace* current = nullptr;
+
+		const auto epoch = std::chrono::steady_clock::now();
+
+		ThreadTrace* getThreadTrace()
+		{
+			if (current)
+				return current;
+
+			auto trace = std::make_shared<ThreadTrace>();
+			trace->ring.resize(ringSize);
+			trace->written = 0;
+
+			std::lock_guard<std::mutex> lock(registryLock);
+			trace->tid = uint32_t(registry.size() + 1);
+			registry.push_back(trace);
+			current = trace.get();
+			return current;
+		}
+
+		void writeString(std::ostream& out, const std::string& str)
+		{
+			out << '"';
+			for (char c : str) {
+				if (c == '"' || c == '\\')
+					out << '\\';
+				out << c;
+			}
+			out << '"';
+		}
+
+		// chrome wants microseconds, keep the ns as decimals
+		void writeMicros(std::ostream& out, uint64_t ns)
+		{
+			char buf[32];
+			snprintf(buf, sizeof(buf), "%llu.%03u", (unsigned long long)(ns / 1000), unsigned(ns % 1000));
+			out << buf;
+		}
+	}
+
+	void HostTrace::setEnabled(bool on)
+	{
+		enabled.store(on, std::memory_order_relaxed);
+	}
+
+	bool HostTrace::isEnabled()
+	{
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	void HostTrace::setRingSize(size_t events)
+	{
+		ringSize = events ? events : 1;
+	}
+
+	void HostTrace::setThreadName(const std::string& name)
+	{
+		ThreadTrace* trace = getThreadTrace();
+		std::lock_guard<std::mutex> lock(registryLock);
+		trace->name = name;
+	}
+
+	uint64_t HostTrace::now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+	}
+
+	void HostTrace::record(const char* name, uint64_t start, uint64_t end)
+	{
+		ThreadTrace* trace = getThreadTrace();
+		uint64_t n = trace->written.load(std::memory_order_relaxed);
+
+		trace->ring[n % trace->ring.size()] = TraceEvent{ name, start, end };
+		trace->written.store(n + 1, std::memory_order_release);
+	}
+
+	void HostTrace::exportChromeJSON(std::ostream& out)
+	{
+		std::lock_guard<std::mutex> lock(registryLock);
+
+		out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		bool first = true;
+
+		for (auto &trace : registry) {
+			out << (first ? "" : ",\n");
+			out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << trace->tid << ",\"args\":{\"name\":";
+			writeString(out, trace->name.empty() ? "thread " + std::to_string(trace->tid) : trace->name);
+			out << "}}";
+			first = false;
+
+			uint64_t written = trace->written.load(std::memory_order_acquire);
+			size_t size = trace->ring.size();
+			uint64_t from = written > size ? written - size : 0;
+
+			for (uint64_t i = from; i < written; i++) {
+				const TraceEvent& evt = trace->ring[i % size];
+
+				out << ",\n{\"name\":";
+				writeString(out, evt.name);
+				out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << trace->tid << ",\"ts\":";
+				writeMicros(out, evt.start);
+				out << ",\"dur\":";
+				writeMicros(out, evt.end - evt.start);
+				out << "}";
+			}
+		}
+
+		out << "\n]}\n";
+	}
+
+	void HostTrace::exportChromeJSON(const std::string& filename)
+	{
+		std::ofstream out(filename);
+		if (!out.is_open())
+			throw std::runtime_error("could not write " + filename);
+
+		exportChromeJSON(out);
+	}
+
+	// like exporting, meant for while tracing is off
+	void HostTrace::clear()
+	{
+		std::lock_guard<std::mutex> lock(registryLock);
+		for (auto &trace : registry)
+			trace->written = 0;
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "types.h"
+#include <string>
+#include <ostream>
+
+// build with GBEMU_TRACE=0 to compile TRACE_SCOPE out
+#ifndef GBEMU_TRACE
+#define GBEMU_TRACE 1
+#endif
+
+namespace GBEmu {
+	// timeline of what the host threads spend their time on. each thread logs
+	// into its own ring, the oldest events go once it's full. only a flag check
+	// is paid while tracing is off.
+	class HostTrace {
+	public:
+		static void setEnabled(bool enabled);
+		static bool isEnabled();
+
+		// events a thread's ring holds. takes effect for threads that log
+		// their first event after this.
+		static void setRingSize(size_t events);
+		// shown in the viewer instead of the thread id
+		static void setThreadName(const std::string& name);
+
+		// ns on a clock shared by all threads
+		static uint64_t now();
+		// name has to outlive the trace, string literals are the idea
+		static void record(const char* name, uint64_t start, uint64_t end);
+
+		// chrome trace event json, for chrome://tracing or ui.perfetto.dev.
+		// best taken with tracing off, the events being written while this
+		// runs may come out garbled.
+		static void exportChromeJSON(std::ostream& out);
+		static void exportChromeJSON(const std::string& filename);
+		static void clear();
+	};
+
+	class TraceScope {
+		const char* name;
+		uint64_t start;
+	public:
+		TraceScope(const char* scopeName) : start(0) {
+			name = HostTrace::isEnabled() ? scopeName : nullptr;
+			if (name)
+				start = HostTrace::now();
+		}
+
+		~TraceScope() {
+			if (name)
+				HostTrace::record(name, start, HostTrace::now());
+		}
+	};
+}
+
+#if GBEMU_TRACE
+#define TRACE_CONCAT2(a, b) a ## b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name) GBEmu::TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name)
+#endif
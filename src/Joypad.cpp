@@ -0,0 +1,82 @@
+#include "Joypad.h"
+
+namespace GBEmu {
+	Joypad::Joypad(Z80 *pr)
+	{
+		cpu = pr;
+		select = 0x30;
+		held = 0;
+
+		Write = bind(&Joypad::OnWrite, this, std::placeholders::_1, std::placeholders::_2);
+		Read = bind(&Joypad::OnRead, this, std::placeholders::_1);
+
+		cpu->mmu.addWriteHook(JOYP_ADDR, &Write);
+		cpu->mmu.addReadHook(JOYP_ADDR, &Read);
+		cpu->mmu.addPeekHook(JOYP_ADDR, &Read);
+	}
+
+	void Joypad::OnWrite(word, byte val)
+	{
+		// only the select lines are writable
+		select = val & 0x30;
+	}
+
+	byte Joypad::OnRead(word)
+	{
+		byte lines = 0;
+		if (!(select & 0x10))
+			lines |= held & 0xF;
+		if (!(select & 0x20))
+			lines |= held >> 4;
+
+		// unused bits read as 1, and so do released buttons
+		return 0xC0 | select | (~lines & 0xF);
+	}
+
+	void Joypad::saveState(StateWriter& out) const
+	{
+		out.put(select);
+		out.put(held);
+	}
+
+	void Joypad::loadState(StateReader& in)
+	{
+		in.get(select);
+		in.get(held);
+	}
+
+	void Joypad::setButtons(byte mask)
+	{
+		// any button going down raises the interrupt
+		if (mask & ~held)
+			cpu->runInterrupt(Z80::int_joypad);
+
+		held = mask;
+	}
+
+	byte Joypad::getButtons() const
+	{
+		return held;
+	}
+
+	void Joypad::press(JOYPAD_BUTTON btn)
+	{
+		setButtons(held | btn);
+	}
+
+	void Joypad::release(JOYPAD_BUTTON btn)
+	{
+		setButtons(held & ~btn);
+	}
+
+	byte getButtonByName(const std::string& name)
+	{
+		static const char* names[8] = { "right", "left", "up", "down", "a", "b", "select", "start" };
+		for (int i = 0; i < 8; i++) {
+			if (name == names[i])
+				return 1 << i;
+		}
+
+		return 0;
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Z80.h"
+
+namespace GBEmu {
+	const word JOYP_ADDR = 0xFF00;
+
+	// as laid out in setButtons() masks. the low nibble is what P14 selects,
+	// the high nibble what P15 selects.
+	enum JOYPAD_BUTTON {
+		JOY_RIGHT = 0x01,
+		JOY_LEFT = 0x02,
+		JOY_UP = 0x04,
+		JOY_DOWN = 0x08,
+		JOY_A = 0x10,
+		JOY_B = 0x20,
+		JOY_SELECT = 0x40,
+		JOY_START = 0x80
+	};
+
+	class Joypad {
+		Z80 *cpu;
+
+		// P14/P15 as last written, 0 means selected
+		byte select;
+		// 1 means held
+		byte held;
+
+		WriteHook Write;
+		ReadHook Read;
+
+		void OnWrite(word, byte val);
+		byte OnRead(word);
+	public:
+		// hooks FF00 on the cpu's mmu. must outlive the cpu's use.
+		Joypad(Z80 *cpu);
+
+		// replace the whole set of held buttons
+		void setButtons(byte mask);
+		byte getButtons() const;
+
+		void press(JOYPAD_BUTTON btn);
+		void release(JOYPAD_BUTTON btn);
+
+		void saveState(StateWriter& out) const;
+		void loadState(StateReader& in);
+	};
+
+	// "start", "a", "up" and so on to a button. 0 if it isn't one.
+	byte getButtonByName(const std::string& name);
+}
@@ -1,4 +1,5 @@
 #include "MMU.h"
+#include <atomic>
 
 // the mmu in general does not assume low-endianness from the target machine.
 namespace GBEmu {
@@ -32,6 +33,7 @@ namespace GBEmu {
 	MMU::MMU()
 	{
 		rom = nullptr;
+		coverage = nullptr;
 
 		inbios = true;
 		MBC1 = false;
@@ -40,6 +42,12 @@ namespace GBEmu {
 
 		// zero the memory, then load the bootstrap program in 0x00.
 		memset(ram.memory, 0, 0x10000);
+
+		static std::atomic<uint64_t> nextID(1);
+		id = nextID++;
+		forkedFrom = 0;
+		writeEpoch = 1;
+		memset(pageEpoch, 0, sizeof(pageEpoch));
 		swappedrambank = 0;
 		swappedrombank = 1;
 	}
@@ -53,6 +61,11 @@ namespace GBEmu {
 		ReadHooks[addr].push_back(func);
 	}
 
+	void MMU::addPeekHook(word addr, ReadHook *func)
+	{
+		PeekHooks[addr] = func;
+	}
+
 	void MMU::addWriteHook(word addr, WriteHook *func)
 	{
 		if (WriteHooks.find(addr) != WriteHooks.end()) {
@@ -62,6 +75,11 @@ namespace GBEmu {
 		WriteHooks[addr].push_back(func);
 	}
 
+	void MMU::addWriteWatch(word from, word to, WriteHook *func)
+	{
+		WriteWatches.push_back(WriteWatch{ from, to, func });
+	}
+
 	void MMU::setMBC1(bool nv)
 	{
 		MBC1 = nv;
@@ -69,6 +87,8 @@ namespace GBEmu {
 
 	void MMU::doRomBanking(byte val)
 	{
+		word before = swappedrombank;
+
 		// 011 111 = 037 or 1F 0001 1111
 		word mask = wbits("00011111");
 		swappedrombank &= ~mask;
@@ -79,6 +99,9 @@ namespace GBEmu {
 			// lower 5 bits of the rom bank are set here 
 			swappedrombank |= val & mask;
 		}
+
+		if (swappedrombank != before)
+			stats.add(STAT_BANK_SWITCHES);
 	}
 
 	// the byte versions handle the details of banking and whatever.
@@ -111,6 +134,8 @@ namespace GBEmu {
 			{ // RAM Bank Number - or - Upper Bits of ROM Bank Number
 				word mask = wbits("01100000");
 
+				word rambank = swappedrambank, rombank = swappedrombank;
+
 				if (memoryModel == rambanking)
 				{ // set ram bank
 					swappedrambank = addr & 3; // last 2 bits
@@ -121,6 +146,9 @@ namespace GBEmu {
 					swappedrombank |= (addr & 3) << 5;
 				}
 
+				if (rambank != swappedrambank || rombank != swappedrombank)
+					stats.add(STAT_BANK_SWITCHES);
+
 				return;
 			}
 		}
@@ -128,13 +156,25 @@ namespace GBEmu {
 
 	void MMU::writeb(word addr, byte val)
 	{
+		if (coverage)
+			coverage->mark(COVERAGE_WRITE, swappedrombank, addr);
+
 		if (WriteHooks.find(addr) != WriteHooks.end()) {
 			for (auto f : WriteHooks.at(addr)) {
+				stats.add(STAT_MMU_SLOW_PATH);
+				stats.add(STAT_IO_HOOKS);
 				(*f)(addr, val);
 				return;
 			}
 		}
 
+		for (auto &w : WriteWatches) {
+			if (addr >= w.from && addr <= w.to) {
+				stats.add(STAT_MMU_SLOW_PATH);
+				(*w.func)(addr, val);
+			}
+		}
+
 		if (addr >= 0xC000 && addr < 0xFE00) // internal ram
 		{
 			if (addr < 0xE000) // writing to internal ram
@@ -143,11 +183,14 @@ namespace GBEmu {
 				addr -= 0xE000;
 
 			// echo values
+			touch(0xC000 + addr);
+			touch(0xE000 + addr);
 			ram.internalram8[addr] = val;
 			ram.internalramecho8[addr] = val;
 			return;
 		}
 		else if (addr < 0x8000) { // READ-ONLY
+			stats.add(STAT_MMU_SLOW_PATH);
 			doMBCstuff(addr, val);
 			return;
 		}
@@ -159,6 +202,7 @@ namespace GBEmu {
 			//__debugbreak();
 		}
 
+		touch(addr);
 		ram.memory[addr] = val;
 	}
 
@@ -169,22 +213,62 @@ namespace GBEmu {
 	}
 
 	byte MMU::readb(word addr) const
+	{
+		if (coverage && !(inbios && addr < 0x100))
+			coverage->mark(COVERAGE_READ, swappedrombank, addr);
+
+		return load(addr);
+	}
+
+	byte MMU::fetchb(word addr) const
+	{
+		if (coverage && !(inbios && addr < 0x100))
+			coverage->mark(COVERAGE_EXEC, swappedrombank, addr);
+
+		return load(addr);
+	}
+
+	byte MMU::load(word addr) const
 	{
 		if (addr < 0x8000)
 		{
 			if (inbios && addr < 0x100)
 				return GBbootstrap[addr];
-			else if (rom)
-			{
-				if (!rom->ismbc1() || addr < 0x4000)
-					return rom->getaddrvalue(addr);
-				else // 0x4000 -> 0x7FFF, do rom banking
-					return rom->readBank(swappedrombank, addr - 0x4000);
-			}
 			else
-				return 0;
-		} else
-			return ram.memory[addr];
+				return readROM(addr, swappedrombank);
+		}
+		else if (addr >= 0xFF00 && addr < 0xFF80) // io ports can be computed on read
+		{
+			auto hook = ReadHooks.find(addr);
+			if (hook != ReadHooks.end() && !hook->second.empty()) {
+				stats.add(STAT_MMU_SLOW_PATH);
+				stats.add(STAT_IO_HOOKS);
+				return (*hook->second.front())(addr);
+			}
+		}
+
+		return ram.memory[addr];
+	}
+
+	byte MMU::readROM(word addr, word bank) const
+	{
+		if (!rom)
+			return 0;
+
+		if (!rom->ismbc1() || addr < 0x4000)
+			return rom->getaddrvalue(addr);
+		else // 0x4000 -> 0x7FFF, do rom banking
+			return rom->readBank(bank, addr - 0x4000);
+	}
+
+	word MMU::getROMBank() const
+	{
+		return swappedrombank;
+	}
+
+	const byte * MMU::getVRAM() const
+	{
+		return ram.vram;
 	}
 
 	word MMU::readw(word addr) const
@@ -194,6 +278,47 @@ namespace GBEmu {
 		return packWord(high, low);
 	}
 
+	void MMU::saveState(StateWriter& out) const
+	{
+		// 0x0000-0x7FFF comes from the rom and echo ram is wram again, so
+		// neither is kept
+		out.write(ram.memory + 0x8000, 0xE000 - 0x8000);
+		out.write(ram.memory + 0xFE00, 0x10000 - 0xFE00);
+		out.put(swappedrombank);
+		out.put(swappedrambank);
+		out.put(inbios);
+		out.put(rambankEnabled);
+		out.put(byte(memoryModel));
+	}
+
+	void MMU::loadState(StateReader& in)
+	{
+		in.read(ram.memory + 0x8000, 0xE000 - 0x8000);
+		in.read(ram.memory + 0xFE00, 0x10000 - 0xFE00);
+		memcpy(ram.memory + 0xE000, ram.memory + 0xC000, 0xFE00 - 0xE000);
+		in.get(swappedrombank);
+		in.get(swappedrambank);
+		in.get(inbios);
+		in.get(rambankEnabled);
+
+		// none of it can be trusted to match a fork anymore
+		for (auto &e : pageEpoch)
+			e = writeEpoch;
+
+		byte model;
+		in.get(model);
+		memoryModel = model ? rambanking : rombanking;
+	}
+
+	byte MMU::peekb(word addr) const
+	{
+		if (addr >= 0xFF00 && addr < 0xFF80) {
+			auto hook = PeekHooks.find(addr);
+			return hook != PeekHooks.end() ? (*hook->second)(addr) : ram.memory[addr];
+		}
+		return load(addr);
+	}
+
 	byte MMU::rawreadb(word addr) const
 	{
 		return ram.memory[addr];
@@ -206,6 +331,7 @@ namespace GBEmu {
 
 	void MMU::rawwriteb(word addr, byte b)
 	{
+		touch(addr);
 		ram.memory[addr] = b;
 	}
 
@@ -220,6 +346,40 @@ namespace GBEmu {
 		this->rom = rom;
 	}
 
+	void MMU::forkFrom(MMU& parent)
+	{
+		bool known = forkedFrom == parent.id;
+
+		// below 0x8000 is the rom's
+		for (int page = 0x8000 >> PAGE_SHIFT; page < (0x10000 >> PAGE_SHIFT); page++) {
+			if (known && parent.pageEpoch[page] <= parentEpochAtFork && pageEpoch[page] <= epochAtFork)
+				continue;
+
+			memcpy(ram.memory + (page << PAGE_SHIFT), parent.ram.memory + (page << PAGE_SHIFT), 1 << PAGE_SHIFT);
+			// changed as far as our own forks go
+			pageEpoch[page] = writeEpoch;
+		}
+
+		rom = parent.rom;
+		MBC1 = parent.MBC1;
+		MBC2 = parent.MBC2;
+		swappedrombank = parent.swappedrombank;
+		swappedrambank = parent.swappedrambank;
+		inbios = parent.inbios;
+		rambankEnabled = parent.rambankEnabled;
+		memoryModel = parent.memoryModel;
+
+		// writes on either side from here on are in a newer epoch
+		forkedFrom = parent.id;
+		parentEpochAtFork = parent.writeEpoch++;
+		epochAtFork = writeEpoch++;
+	}
+
+	ROM* MMU::getROM() const
+	{
+		return rom;
+	}
+
 	void MMU::cleanBIOS()
 	{
 		inbios = false;
@@ -1,5 +1,8 @@
 #include "types.h"
 #include "ROM.h"
+#include "Stats.h"
+#include "State.h"
+#include "Coverage.h"
 
 #pragma once
 
@@ -12,6 +15,15 @@ namespace GBEmu {
 	private:
 		map<word, vector<ReadHook*>> ReadHooks;
 		map<word, vector<WriteHook*>> WriteHooks;
+		// what peekb asks for registers that are worked out on read
+		map<word, ReadHook*> PeekHooks;
+
+		// observers for address ranges, ran before the write lands
+		struct WriteWatch {
+			word from, to;
+			WriteHook* func;
+		};
+		vector<WriteWatch> WriteWatches;
 
 		union {
 			struct {
@@ -33,11 +45,30 @@ namespace GBEmu {
 			byte memory[0x10000];
 		} ram;
 
+		// 256 byte pages, each with the epoch it was last written in. forkFrom
+		// goes by these to copy only what either side changed, and writing
+		// costs one more store.
+		static const int PAGE_SHIFT = 8;
+		uint32_t writeEpoch;
+		uint32_t pageEpoch[0x10000 >> PAGE_SHIFT];
+
+		// which mmu this one was last made a copy of, and the epochs of both then
+		uint64_t id;
+		uint64_t forkedFrom;
+		uint32_t parentEpochAtFork, epochAtFork;
+
+		void touch(word addr) {
+			pageEpoch[addr >> PAGE_SHIFT] = writeEpoch;
+		}
+
 		byte rambanks;
 		ROM* rom;
 		word swappedrambank, swappedrombank;
 		size_t romsize;
 
+		// readb without the coverage
+		byte load(word addr) const;
+
 		void doRomBanking(byte v);
 		void doMBCstuff(word addr, byte val);
 
@@ -51,16 +82,40 @@ namespace GBEmu {
 		} memoryModel;
 	public:
 
+		// for the whole machine. the cpu and video count here too.
+		mutable Stats stats;
+
+		// when set, every fetch, read and write is marked in here. the bios
+		// isn't part of the rom, so nothing it does is.
+		Coverage* coverage;
+
 		MMU();
 
 		void addReadHook(word addr, ReadHook* func);
 		void addWriteHook(word addr, WriteHook* func);
+		// unlike write hooks, watches don't replace the write. [from, to] is inclusive.
+		void addWriteWatch(word from, word to, WriteHook* func);
+		// for a register that's worked out when read rather than stored,
+		// so peekb can see it too. the hook mustn't change anything.
+		void addPeekHook(word addr, ReadHook* func);
 
 		void setMBC1(bool nv);
 		void writeb(word addr, byte val);
 		void writew(word addr, word val);
 		byte readb(word addr) const;
 		word readw(word addr) const;
+		// readb for instruction bytes, which coverage counts apart from data
+		byte fetchb(word addr) const;
+
+		// what the cartridge has at addr (< 0x8000) with the given bank switched in
+		byte readROM(word addr, word bank) const;
+		word getROMBank() const;
+		const byte* getVRAM() const;
+
+		// what readb would give, without setting off read hooks (only peek
+		// hooks), stats or coverage. for tools that look at memory and
+		// mustn't change anything.
+		byte peekb(word addr) const;
 
 		// straight up from our structure
 		byte rawreadb(word addr) const;
@@ -69,6 +124,16 @@ namespace GBEmu {
 		void rawwritew(word addr, word w);
 
 		void assignrom(ROM* rom);
+		ROM* getROM() const;
 		void cleanBIOS();
+
+		// memory and banking. hooks and the rom are left as they are.
+		void saveState(StateWriter& out) const;
+		void loadState(StateReader& in);
+
+		// become a copy of parent, sharing its rom. after the first time,
+		// only the pages either one wrote since the last fork between
+		// them are copied. hooks, stats and coverage stay our own.
+		void forkFrom(MMU& parent);
 	};
 }
\ No newline at end of file
@@ -0,0 +1,47 @@
+#include "Machine.h"
+
+namespace GBEmu {
+	namespace {
+		// video and joypad state is a few bytes, going through a state is simplest
+		template <class T> void copyState(const T& from, T& to)
+		{
+			byte buffer[64];
+			StateWriter out(buffer, sizeof(buffer));
+			from.saveState(out);
+
+			StateReader in(buffer, out.getSize());
+			to.loadState(in);
+		}
+	}
+
+	Machine::Machine(ROM* rom)
+		: vid(&cpu), pad(&cpu)
+	{
+		if (rom)
+			cpu.mmu.assignrom(rom);
+	}
+
+	std::unique_ptr<Machine> Machine::fork()
+	{
+		std::unique_ptr<Machine> child(new Machine());
+		child->forkFrom(*this);
+		return child;
+	}
+
+	void Machine::forkFrom(Machine& parent)
+	{
+		// the cpu first, video's loadState looks at the vram it brings
+		cpu.forkFrom(parent.cpu);
+		copyState(parent.vid, vid);
+		copyState(parent.pad, pad);
+	}
+
+	byte Machine::step()
+	{
+		byte cycles = cpu.step();
+		if (vid.due())
+			vid.sync();
+		cpu.executeinterrupts();
+		return cycles;
+	}
+}
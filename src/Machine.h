@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Z80.h"
+#include "Video.h"
+#include "Joypad.h"
+
+namespace GBEmu {
+	// a cpu with its video and joypad hooked up, for when there are lots of
+	// them, like searches and tests branching one state into many futures.
+	//
+	// forking copies the registers and the memory pages that changed since
+	// the two machines were last the same, so refilling a pool of children
+	// from one parent costs not much more than the registers. the rom is
+	// shared, never copied. hooks belong to each machine, and attached
+	// tools (profilers, breakpoints, coverage) aren't carried over.
+	class Machine {
+	public:
+		Z80 cpu;
+		Video vid;
+		Joypad pad;
+
+		explicit Machine(ROM* rom = nullptr);
+
+		// a new machine in the same state. being new, all of ram is copied,
+		// forkFrom into one that's around already is the cheap way.
+		std::unique_ptr<Machine> fork();
+		// become a copy of parent. video settings (frame buffer, frame
+		// skip, threading) stay as they were.
+		void forkFrom(Machine& parent);
+
+		// one instruction, with the video caught up and interrupts taken
+		byte step();
+	};
+}
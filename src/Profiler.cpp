@@ -0,0 +1,127 @@
+#include "Profiler.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace GBEmu {
+	Profiler::Profiler()
+	{
+		reset();
+	}
+
+	void Profiler::addBank(word bank)
+	{
+		// every bank up to this one, record() only checks the size
+		bankedCycles.resize(bank + 1, vector<uint64_t>(0x4000, 0));
+		bankedHits.resize(bank + 1, vector<uint64_t>(0x4000, 0));
+	}
+
+	void Profiler::reset()
+	{
+		cycles.assign(0x10000, 0);
+		hits.assign(0x10000, 0);
+
+		for (size_t i = 0; i < bankedCycles.size(); i++) {
+			bankedCycles[i].assign(0x4000, 0);
+			bankedHits[i].assign(0x4000, 0);
+		}
+
+		haltedCycles = 0;
+		totalCycles = 0;
+	}
+
+	vector<Profiler::Entry> Profiler::getEntries() const
+	{
+		vector<Entry> entries;
+
+		for (uint32_t pc = 0; pc < 0x10000; pc++) {
+			if (hits[pc])
+				entries.push_back(Entry{ 0, word(pc), cycles[pc], hits[pc] });
+		}
+
+		for (size_t bank = 0; bank < bankedCycles.size(); bank++) {
+			if (bankedCycles[bank].empty())
+				continue;
+
+			for (word i = 0; i < 0x4000; i++) {
+				if (bankedHits[bank][i])
+					entries.push_back(Entry{ word(bank), word(0x4000 + i), bankedCycles[bank][i], bankedHits[bank][i] });
+			}
+		}
+
+		std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+			return a.cycles > b.cycles;
+		});
+
+		return entries;
+	}
+
+	uint64_t Profiler::getTotalCycles() const
+	{
+		return totalCycles;
+	}
+
+	uint64_t Profiler::getHaltedCycles() const
+	{
+		return haltedCycles;
+	}
+
+	vector<std::pair<std::string, uint64_t>> Profiler::getByFunction(const SymbolTable* syms, bool withBank) const
+	{
+		map<std::string, uint64_t> byName;
+
+		for (auto &e : getEntries()) {
+			std::string name;
+			word offset;
+
+			if (!syms || !syms->lookup(e.bank, e.pc, name, offset)) {
+				char where[16];
+				sprintf(where, "%02X:%04X", e.bank, e.pc);
+				name = where;
+			}
+
+			if (withBank) {
+				char bank[16];
+				sprintf(bank, "bank%02X;", e.bank);
+				name = bank + name;
+			}
+
+			byName[name] += e.cycles;
+		}
+
+		if (haltedCycles)
+			byName["<halted>"] += haltedCycles;
+
+		vector<std::pair<std::string, uint64_t>> out(byName.begin(), byName.end());
+		std::stable_sort(out.begin(), out.end(), [](const std::pair<std::string, uint64_t>& a, const std::pair<std::string, uint64_t>& b) {
+			return a.second > b.second;
+		});
+
+		return out;
+	}
+
+	void Profiler::exportFlat(std::ostream& out, const SymbolTable* syms, size_t top) const
+	{
+		auto funcs = getByFunction(syms, false);
+		if (top && funcs.size() > top)
+			funcs.resize(top);
+
+		char line[128];
+		sprintf(line, "%14s %7s  %s\n", "cycles", "%", syms ? "function" : "pc");
+		out << line;
+
+		for (auto &f : funcs) {
+			double pct = totalCycles ? 100.0 * f.second / totalCycles : 0;
+			sprintf(line, "%14llu %6.2f%%  ", (unsigned long long)f.second, pct);
+			out << line << f.first << "\n";
+		}
+
+		sprintf(line, "%14llu total\n", (unsigned long long)totalCycles);
+		out << line;
+	}
+
+	void Profiler::exportFolded(std::ostream& out, const SymbolTable* syms) const
+	{
+		for (auto &f : getByFunction(syms, true))
+			out << f.first << " " << f.second << "\n";
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "types.h"
+#include "SymbolTable.h"
+#include <ostream>
+
+namespace GBEmu {
+	// where the emulated cycles went, per (rom bank, pc). counting every
+	// instruction is two adds into flat arrays, cheap enough to leave on.
+	class Profiler {
+		// by pc, for everything but 0x4000-0x7FFF
+		vector<uint64_t> cycles, hits;
+		// 0x4000-0x7FFF, per bank, made as banks show up
+		vector<vector<uint64_t>> bankedCycles, bankedHits;
+		uint64_t haltedCycles;
+		uint64_t totalCycles;
+
+	public:
+		struct Entry {
+			word bank;
+			word pc;
+			uint64_t cycles;
+			uint64_t hits;
+		};
+
+		Profiler();
+
+		// an instruction at pc took this long. bank is only looked at for romx.
+		void record(word bank, word pc, uint32_t cyc) {
+			totalCycles += cyc;
+
+			if (pc < 0x4000 || pc >= 0x8000) {
+				cycles[pc] += cyc;
+				hits[pc]++;
+				return;
+			}
+
+			if (bank >= bankedCycles.size())
+				addBank(bank);
+
+			bankedCycles[bank][pc - 0x4000] += cyc;
+			bankedHits[bank][pc - 0x4000]++;
+		}
+
+		void recordHalted(uint32_t cyc) {
+			haltedCycles += cyc;
+			totalCycles += cyc;
+		}
+
+		void reset();
+
+		// every pc that ran, most cycles first
+		vector<Entry> getEntries() const;
+		uint64_t getTotalCycles() const;
+		uint64_t getHaltedCycles() const;
+
+		// cycles by label (or by pc with no symbols), most first. top 0 is everything.
+		void exportFlat(std::ostream& out, const SymbolTable* syms, size_t top = 0) const;
+		// "bank;label cycles" lines for flamegraph.pl and friends
+		void exportFolded(std::ostream& out, const SymbolTable* syms) const;
+
+	private:
+		void addBank(word bank);
+		// by label, or by pc when there's no label for it
+		vector<std::pair<std::string, uint64_t>> getByFunction(const SymbolTable* syms, bool withBank) const;
+	};
+}
@@ -7,6 +7,7 @@ namespace GBEmu {
 	{
 		mbc1 = false;
 		mbc2 = false;
+		hash = 0;
 	}
 
 	byte ROM::getromsize()
@@ -34,6 +35,25 @@ namespace GBEmu {
 		in.read((char*)bin.data(), romsize);
 		// read succesfully
 
+		readheader();
+		computehash();
+	}
+
+	void ROM::loadfrombuffer(const vbyte& data)
+	{
+		bin = data;
+		readheader();
+		computehash();
+	}
+
+	void ROM::readheader()
+	{
+		if (bin.size() < 0x150)
+			throw std::runtime_error("rom is too small to have a header");
+
+		mbc1 = false;
+		mbc2 = false;
+
 		switch (bin[0x147]) {
 		case 1:
 		case 2:
@@ -119,9 +139,39 @@ namespace GBEmu {
 		}
 	}
 
-	byte ROM::readBank(byte Bank, word relativeAddr)
+	byte ROM::readBank(byte bank, word relativeAddr)
 	{
-		return 0; // stub
+		size_t addr = size_t(bank) * 0x4000 + relativeAddr;
+		if (addr < bin.size())
+			return bin[addr];
+		else
+			return 0;
+	}
+
+	size_t ROM::getsize()
+	{
+		return bin.size();
+	}
+
+	size_t ROM::getbankcount()
+	{
+		return (bin.size() + 0x3FFF) / 0x4000;
+	}
+
+	uint64_t ROM::gethash()
+	{
+		return hash;
+	}
+
+	void ROM::computehash()
+	{
+		// fnv-1a
+		uint64_t h = 14695981039346656037ull;
+		for (auto b : bin) {
+			h ^= b;
+			h *= 1099511628211ull;
+		}
+		hash = h;
 	}
 
 	void ROM::copy(int32_t start, size_t size, byte* dst)
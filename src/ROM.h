@@ -7,6 +7,12 @@ namespace GBEmu {
 		vbyte bin;
 
 		bool mbc1, mbc2;
+		// worked out once on load, save states check it
+		uint64_t hash;
+
+		// work out what's in the cart from the header
+		void readheader();
+		void computehash();
 	public:
 		ROM();
 		void copy(int32_t start, size_t size, byte* dst);
@@ -24,12 +30,20 @@ namespace GBEmu {
 		bool ismbc1();
 		bool ismbc2();
 
-		// dst needs to be large enough.
+		// relativeAddr is from the start of the bank, 0 -> 0x3FFF
 		byte readBank(byte bank, word relativeAddr);
 
+		// what's actually in the file, which the header may disagree with
+		size_t getsize();
+		size_t getbankcount();
+		// of the whole image, to tell roms apart
+		uint64_t gethash();
+
 		byte getaddrvalue(word addr);
 
 		// loads rom binary from file
 		void loadfromfile(const char* filename);
+		// same, from a rom image already in memory
+		void loadfrombuffer(const vbyte& data);
 	};
 }
\ No newline at end of file
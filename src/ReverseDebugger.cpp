@@ -0,0 +1,243 @@
+#include "ReverseDebugger.h"
+#include "SaveState.h"
+
+namespace GBEmu {
+	namespace {
+		// replays have already been seen once, keep them off the
+		// breakpoints, trace, profiles, coverage and stats
+		struct Unobserved {
+			Z80* cpu;
+			Breakpoints* breakpoints;
+			ExecTrace* trace;
+			Profiler* profiler;
+			CallProfiler* callProfiler;
+			Coverage* coverage;
+			StatsSnapshot stats;
+
+			Unobserved(Z80* pr) : cpu(pr) {
+				breakpoints = cpu->breakpoints;
+				trace = cpu->trace;
+				profiler = cpu->profiler;
+				callProfiler = cpu->callProfiler;
+				coverage = cpu->mmu.coverage;
+				stats = cpu->mmu.stats.mark();
+				cpu->breakpoints = nullptr;
+				cpu->trace = nullptr;
+				cpu->profiler = nullptr;
+				cpu->callProfiler = nullptr;
+				cpu->mmu.coverage = nullptr;
+			}
+
+			~Unobserved() {
+				cpu->breakpoints = breakpoints;
+				cpu->trace = trace;
+				cpu->profiler = profiler;
+				cpu->callProfiler = callProfiler;
+				cpu->mmu.coverage = coverage;
+				cpu->mmu.stats.discardSince(stats);
+			}
+		};
+	}
+
+	ReverseDebugger::ReverseDebugger(Z80* pr, Video* video, Joypad* joypad, size_t bytes, uint32_t cycles)
+	{
+		cpu = pr;
+		vid = video;
+		pad = joypad;
+		budget = bytes;
+		interval = cycles ? cycles : 1;
+		reset();
+	}
+
+	void ReverseDebugger::reset()
+	{
+		snapshots.clear();
+		inputs.clear();
+		position = 0;
+		takeSnapshot();
+	}
+
+	bool ReverseDebugger::advance()
+	{
+		if (!cpu->step() && cpu->breakpoints && cpu->breakpoints->isStopped(*cpu))
+			return false;
+
+		if (vid->due())
+			vid->sync();
+		cpu->executeinterrupts();
+
+		position++;
+		applyInputs();
+		return true;
+	}
+
+	bool ReverseDebugger::step()
+	{
+		if (!advance())
+			return false;
+
+		if (uint32_t(cpu->clock.machine - snapshots.back().clock) >= interval)
+			takeSnapshot();
+		return true;
+	}
+
+	uint64_t ReverseDebugger::run(uint64_t count)
+	{
+		uint64_t steps = 0;
+		while (steps < count && step())
+			steps++;
+		return steps;
+	}
+
+	void ReverseDebugger::setButtons(byte mask)
+	{
+		inputs.push_back(InputEvent{ position, mask });
+		if (pad)
+			pad->setButtons(mask);
+	}
+
+	void ReverseDebugger::applyInputs()
+	{
+		if (!pad || inputs.empty() || inputs.back().position < position)
+			return;
+
+		// usually the one at the back, if any
+		size_t i = inputs.size();
+		while (i > 0 && inputs[i - 1].position >= position)
+			i--;
+		for (; i < inputs.size() && inputs[i].position == position; i++)
+			pad->setButtons(inputs[i].buttons);
+	}
+
+	void ReverseDebugger::takeSnapshot()
+	{
+		Snapshot snap;
+		snap.position = position;
+		snap.clock = cpu->clock.machine;
+		snap.data.resize(getSaveStateSize(pad != nullptr));
+		saveState(*cpu, *vid, pad, snap.data.data(), snap.data.size());
+
+		while (!snapshots.empty() && getMemoryUsed() + snap.data.size() > budget)
+			snapshots.pop_front();
+
+		snapshots.push_back(std::move(snap));
+
+		// input from before the oldest snapshot can't be replayed anymore
+		while (!inputs.empty() && inputs.front().position < snapshots.front().position)
+			inputs.pop_front();
+	}
+
+	const ReverseDebugger::Snapshot* ReverseDebugger::findSnapshot(uint64_t target) const
+	{
+		for (size_t i = snapshots.size(); i > 0; i--) {
+			if (snapshots[i - 1].position <= target)
+				return &snapshots[i - 1];
+		}
+
+		return nullptr;
+	}
+
+	void ReverseDebugger::restore(const Snapshot& snap)
+	{
+		loadState(*cpu, *vid, pad, snap.data.data(), snap.data.size());
+
+		position = snap.position;
+		applyInputs();
+	}
+
+	void ReverseDebugger::replayTo(uint64_t target)
+	{
+		Unobserved guard(cpu);
+		while (position < target)
+			advance();
+	}
+
+	void ReverseDebugger::forgetFuture()
+	{
+		while (snapshots.size() > 1 && snapshots.back().position > position)
+			snapshots.pop_back();
+		while (!inputs.empty() && inputs.back().position > position)
+			inputs.pop_back();
+
+		// don't stop right away on a breakpoint we went back to
+		if (cpu->breakpoints)
+			cpu->breakpoints->resumeFrom(*cpu);
+	}
+
+	bool ReverseDebugger::stepBack(uint64_t count)
+	{
+		if (count > position)
+			return false;
+
+		uint64_t target = position - count;
+		const Snapshot* snap = findSnapshot(target);
+		if (!snap)
+			return false;
+
+		restore(*snap);
+		replayTo(target);
+		forgetFuture();
+		return true;
+	}
+
+	bool ReverseDebugger::continueBack()
+	{
+		Breakpoints* breakpoints = cpu->breakpoints;
+		uint64_t end = position;
+
+		// look through the stretch after each snapshot, newest first, and
+		// remember the last time a breakpoint matched in it
+		for (size_t i = snapshots.size(); breakpoints && breakpoints->isArmed() && i > 0; i--) {
+			const Snapshot& snap = snapshots[i - 1];
+			if (snap.position >= end)
+				continue;
+
+			uint64_t found = end;
+			restore(snap);
+			{
+				Unobserved guard(cpu);
+				while (position < end) {
+					if (!cpu->halted && breakpoints->match(*cpu))
+						found = position;
+					advance();
+				}
+			}
+
+			if (found != end) {
+				restore(snap);
+				replayTo(found);
+				forgetFuture();
+				return true;
+			}
+
+			end = snap.position;
+		}
+
+		restore(snapshots.front());
+		forgetFuture();
+		return false;
+	}
+
+	uint64_t ReverseDebugger::getPosition() const
+	{
+		return position;
+	}
+
+	uint64_t ReverseDebugger::getOldestPosition() const
+	{
+		return snapshots.front().position;
+	}
+
+	size_t ReverseDebugger::getSnapshotCount() const
+	{
+		return snapshots.size();
+	}
+
+	size_t ReverseDebugger::getMemoryUsed() const
+	{
+		size_t used = inputs.size() * sizeof(InputEvent);
+		for (auto &s : snapshots)
+			used += s.data.size();
+		return used;
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Z80.h"
+#include "Video.h"
+#include "Joypad.h"
+#include <deque>
+
+namespace GBEmu {
+	// steps the machine like the run loop does and keeps enough history to
+	// go back. every interval cycles the whole state is copied away; going
+	// back restores the closest copy before the target and replays from it.
+	// replays are exact as long as everything that comes from outside (only
+	// buttons, for now) goes through here.
+	//
+	// history is measured in steps, one per instruction or halted slice.
+	// when the snapshots outgrow the budget the oldest go. going back forgets
+	// the future, so stepping forward again makes new history.
+	//
+	// the video has to be in catch-up mode, and its hooks do run during
+	// replays. the cpu's breakpoints, trace, profilers and coverage are set
+	// aside for them, and what they add to the stats is taken back out.
+	class ReverseDebugger {
+	public:
+		ReverseDebugger(Z80* cpu, Video* vid, Joypad* pad, size_t budget = 32 << 20, uint32_t interval = FRAME_CYCLES / 2);
+
+		// one step forward. false if a breakpoint stopped it first.
+		bool step();
+		// forward until a breakpoint or count steps. how many it took.
+		uint64_t run(uint64_t count);
+
+		// the held buttons from now on
+		void setButtons(byte mask);
+
+		// false, without moving, if history doesn't go back that far
+		bool stepBack(uint64_t count = 1);
+		// back to the last time a breakpoint would've stopped the cpu. with
+		// none in reach, goes as far back as it can and returns false.
+		bool continueBack();
+
+		// forget all history, e.g. after registers or memory were poked
+		void reset();
+
+		uint64_t getPosition() const;
+		// how far back stepBack() can go
+		uint64_t getOldestPosition() const;
+		size_t getSnapshotCount() const;
+		size_t getMemoryUsed() const;
+
+	private:
+		struct Snapshot {
+			uint64_t position;
+			uint32_t clock;
+			vbyte data;
+		};
+
+		struct InputEvent {
+			uint64_t position;
+			byte buttons;
+		};
+
+		Z80* cpu;
+		Video* vid;
+		Joypad* pad;
+		size_t budget;
+		uint32_t interval;
+
+		std::deque<Snapshot> snapshots;
+		std::deque<InputEvent> inputs;
+		uint64_t position;
+
+		// the step itself, false if a breakpoint stopped it
+		bool advance();
+		void applyInputs();
+		void takeSnapshot();
+		// the latest snapshot at or before position, nullptr if none
+		const Snapshot* findSnapshot(uint64_t target) const;
+		void restore(const Snapshot& snap);
+		void replayTo(uint64_t target);
+		void forgetFuture();
+	};
+}
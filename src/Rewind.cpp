@@ -0,0 +1,155 @@
+#include "Rewind.h"
+#include "SaveState.h"
+#include <stdexcept>
+
+namespace GBEmu {
+	namespace {
+		void putVarint(vbyte& out, size_t v)
+		{
+			while (v >= 0x80) {
+				out.push_back(byte(v | 0x80));
+				v >>= 7;
+			}
+			out.push_back(byte(v));
+		}
+
+		size_t getVarint(const vbyte& in, size_t& pos)
+		{
+			size_t v = 0;
+			for (int shift = 0; pos < in.size(); shift += 7) {
+				byte b = in[pos++];
+				v |= size_t(b & 0x7F) << shift;
+				if (!(b & 0x80))
+					return v;
+			}
+			throw std::runtime_error("rewind delta ends too soon");
+		}
+
+		uint64_t load64(const byte* p)
+		{
+			uint64_t v;
+			memcpy(&v, p, sizeof(v));
+			return v;
+		}
+	}
+
+	Rewind::Rewind(Z80* cpu, Video* vid, Joypad* pad, size_t budget, int every)
+		: cpu(cpu), vid(vid), pad(pad), budget(budget), every(every < 1 ? 1 : every)
+	{
+		newest.resize(getSaveStateSize(pad != nullptr));
+		next.resize(newest.size());
+		clear();
+	}
+
+	// (zeros, literals) pairs as varints, each followed by that many bytes of
+	// from ^ to. the zeros at the end aren't written.
+	void Rewind::encodeDelta(const byte* from, const byte* to, size_t size, vbyte& out)
+	{
+		size_t i = 0;
+		while (i < size) {
+			size_t start = i;
+			while (i + 8 <= size && load64(from + i) == load64(to + i))
+				i += 8;
+			while (i < size && from[i] == to[i])
+				i++;
+			if (i == size)
+				break;
+
+			// a single byte that's the same doesn't end a literal, it'd cost more
+			size_t literal = i;
+			while (i < size && (from[i] != to[i] || (i + 1 < size && from[i + 1] != to[i + 1])))
+				i++;
+
+			putVarint(out, literal - start);
+			putVarint(out, i - literal);
+			for (size_t j = literal; j < i; j++)
+				out.push_back(from[j] ^ to[j]);
+		}
+	}
+
+	void Rewind::applyDelta(const vbyte& delta, byte* state, size_t size)
+	{
+		size_t pos = 0, at = 0;
+		while (pos < delta.size()) {
+			at += getVarint(delta, pos);
+			size_t literal = getVarint(delta, pos);
+			if (at + literal > size || pos + literal > delta.size())
+				throw std::runtime_error("rewind delta doesn't fit the state");
+
+			for (size_t j = 0; j < literal; j++)
+				state[at++] ^= delta[pos++];
+		}
+	}
+
+	void Rewind::onFrame()
+	{
+		if (++frames < every)
+			return;
+
+		frames = 0;
+		capture();
+	}
+
+	void Rewind::capture()
+	{
+		saveState(*cpu, *vid, pad, next.data(), next.size());
+
+		if (haveNewest) {
+			scratch.clear();
+			encodeDelta(next.data(), newest.data(), newest.size(), scratch);
+
+			deltaBytes += scratch.size();
+			deltas.emplace_back(scratch.begin(), scratch.end());
+		}
+
+		newest.swap(next);
+		haveNewest = true;
+
+		while (!deltas.empty() && getMemoryUsed() > budget) {
+			deltaBytes -= deltas.front().size();
+			deltas.pop_front();
+		}
+	}
+
+	bool Rewind::rewind()
+	{
+		if (!haveNewest)
+			return false;
+
+		loadState(*cpu, *vid, pad, newest.data(), newest.size());
+
+		if (deltas.empty())
+			haveNewest = false;
+		else {
+			applyDelta(deltas.back(), newest.data(), newest.size());
+			deltaBytes -= deltas.back().size();
+			deltas.pop_back();
+		}
+
+		frames = 0;
+		return true;
+	}
+
+	void Rewind::clear()
+	{
+		deltas.clear();
+		deltaBytes = 0;
+		haveNewest = false;
+		frames = 0;
+	}
+
+	size_t Rewind::getSnapshotCount() const
+	{
+		return haveNewest ? deltas.size() + 1 : 0;
+	}
+
+	size_t Rewind::getMemoryUsed() const
+	{
+		return newest.size() + next.size() + deltaBytes;
+	}
+
+	uint64_t Rewind::getFramesKept() const
+	{
+		return uint64_t(deltas.size()) * every;
+	}
+}
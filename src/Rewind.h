@@ -0,0 +1,56 @@
+#pragma once
+
+#include "types.h"
+#include <deque>
+
+namespace GBEmu {
+	class Z80;
+	class Video;
+	class Joypad;
+
+	// rewinding for players, as opposed to ReverseDebugger's exact stepping.
+	// a snapshot is taken every few frames. only the newest one is kept
+	// whole, the rest as the xor against the one after it, with the runs
+	// of zeros squeezed out. most of memory stays the same between
+	// frames, so a delta is usually a few hundred bytes and a minute fits
+	// in a few megabytes. going back undoes the deltas newest first, and
+	// when the budget runs out the oldest go.
+	class Rewind {
+	public:
+		// budget covers everything kept. pad can be null.
+		Rewind(Z80* cpu, Video* vid, Joypad* pad, size_t budget = 4 << 20, int every = 2);
+
+		// once a frame, between steps. takes a snapshot every so many frames.
+		void onFrame();
+		void capture();
+
+		// back to the last snapshot taken, and the one before that the
+		// next time. false once there's nothing older.
+		bool rewind();
+		void clear();
+
+		size_t getSnapshotCount() const;
+		size_t getMemoryUsed() const;
+		// how far back rewinding can go
+		uint64_t getFramesKept() const;
+
+	private:
+		Z80* cpu;
+		Video* vid;
+		Joypad* pad;
+		size_t budget;
+		int every;
+		int frames;
+
+		// the newest snapshot, where the next one is made, and where its
+		// delta is worked out
+		vbyte newest, next, scratch;
+		bool haveNewest;
+		// deltas.back() turns newest into the one before it
+		std::deque<vbyte> deltas;
+		size_t deltaBytes;
+
+		static void encodeDelta(const byte* from, const byte* to, size_t size, vbyte& out);
+		static void applyDelta(const vbyte& delta, byte* state, size_t size);
+	};
+}
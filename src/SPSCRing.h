@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace GBEmu {
+
+	// lock-free ring for exactly one producer thread and one consumer thread.
+	// N has to be a power of two.
+	template <class T, size_t N>
+	class SPSCRing {
+		static_assert((N & (N - 1)) == 0, "ring size must be a power of two");
+
+		T items[N];
+
+		// kept on separate cache lines so both ends don't fight over one
+		alignas(64) std::atomic<size_t> head; // next to pop, owned by the consumer
+		alignas(64) std::atomic<size_t> tail; // next to push, owned by the producer
+	public:
+		SPSCRing() : head(0), tail(0) {}
+
+		// producer side. false if full.
+		bool push(const T& v) {
+			size_t t = tail.load(std::memory_order_relaxed);
+			if (t - head.load(std::memory_order_acquire) == N)
+				return false;
+
+			items[t & (N - 1)] = v;
+			tail.store(t + 1, std::memory_order_release);
+			return true;
+		}
+
+		// consumer side. false if empty.
+		bool pop(T& v) {
+			size_t h = head.load(std::memory_order_relaxed);
+			if (h == tail.load(std::memory_order_acquire))
+				return false;
+
+			v = items[h & (N - 1)];
+			head.store(h + 1, std::memory_order_release);
+			return true;
+		}
+
+		bool empty() const {
+			return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+		}
+	};
+}
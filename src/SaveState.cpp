@@ -0,0 +1,118 @@
+#include "SaveState.h"
+#include "Z80.h"
+#include "Video.h"
+#include "Joypad.h"
+#include "State.h"
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <cstring>
+#include <stdexcept>
+
+namespace GBEmu {
+	namespace {
+		uint64_t getROMHash(const Z80& cpu)
+		{
+			ROM* rom = cpu.mmu.getROM();
+			return rom ? rom->gethash() : 0;
+		}
+
+		void writeBody(StateWriter& out, const Z80& cpu, const Video& vid, const Joypad* pad)
+		{
+			cpu.saveState(out);
+			vid.saveState(out);
+			if (pad)
+				pad->saveState(out);
+		}
+
+		// a dry run, nothing in the machine changes the layout
+		size_t measureState(bool withJoypad)
+		{
+			std::unique_ptr<Z80> cpu(new Z80());
+			Video vid(cpu.get());
+			Joypad pad(cpu.get());
+
+			StateWriter counter;
+			writeBody(counter, *cpu, vid, withJoypad ? &pad : nullptr);
+			return sizeof(SaveStateHeader) + counter.getSize();
+		}
+
+		// reads the header and checks it against the machine and the buffer
+		SaveStateHeader checkHeader(const Z80& cpu, const byte* buffer, size_t size)
+		{
+			SaveStateHeader header;
+			if (size < sizeof(header))
+				throw std::runtime_error("save state ends too soon");
+			memcpy(&header, buffer, sizeof(header));
+
+			if (memcmp(header.magic, "GBST", 4))
+				throw std::runtime_error("not a save state");
+			if (header.version != SAVESTATE_VERSION)
+				throw std::runtime_error("save state is version " + std::to_string(header.version) +
+					", only version " + std::to_string(SAVESTATE_VERSION) + " can be loaded");
+			// the layout is fixed, so anything else is a broken state
+			if (header.size != getSaveStateSize((header.flags & SAVESTATE_JOYPAD) != 0))
+				throw std::runtime_error("save state is the wrong size");
+			if (header.size > size)
+				throw std::runtime_error("save state ends too soon");
+			if (header.romHash != getROMHash(cpu))
+				throw std::runtime_error("save state is for another rom");
+
+			return header;
+		}
+	}
+
+	size_t getSaveStateSize(bool withJoypad)
+	{
+		// worked out once, on whichever thread gets here first
+		static const size_t sizes[2] = { measureState(false), measureState(true) };
+		return sizes[withJoypad];
+	}
+
+	size_t saveState(const Z80& cpu, const Video& vid, const Joypad* pad, byte* buffer, size_t size)
+	{
+		if (size < sizeof(SaveStateHeader))
+			throw std::runtime_error("state doesn't fit");
+
+		StateWriter out(buffer + sizeof(SaveStateHeader), size - sizeof(SaveStateHeader));
+		writeBody(out, cpu, vid, pad);
+
+		SaveStateHeader header = { { 'G', 'B', 'S', 'T' }, SAVESTATE_VERSION, uint16_t(pad ? SAVESTATE_JOYPAD : 0),
+			uint32_t(sizeof(header) + out.getSize()), 0, getROMHash(cpu) };
+		memcpy(buffer, &header, sizeof(header));
+
+		return header.size;
+	}
+
+	void loadState(Z80& cpu, Video& vid, Joypad* pad, const byte* buffer, size_t size)
+	{
+		SaveStateHeader header = checkHeader(cpu, buffer, size);
+
+		StateReader in(buffer + sizeof(header), header.size - sizeof(header));
+		cpu.loadState(in);
+		vid.loadState(in);
+		if (pad && (header.flags & SAVESTATE_JOYPAD))
+			pad->loadState(in);
+	}
+
+	void saveStateFile(const Z80& cpu, const Video& vid, const Joypad* pad, const std::string& filename)
+	{
+		vbyte buffer(getSaveStateSize(pad != nullptr));
+		size_t used = saveState(cpu, vid, pad, buffer.data(), buffer.size());
+
+		std::ofstream out(filename, std::ios::out | std::ios::binary);
+		if (!out.is_open())
+			throw std::runtime_error("could not write " + filename);
+		out.write((const char*)buffer.data(), used);
+	}
+
+	void loadStateFile(Z80& cpu, Video& vid, Joypad* pad, const std::string& filename)
+	{
+		std::ifstream in(filename, std::ios::in | std::ios::binary);
+		if (!in.is_open())
+			throw std::runtime_error("save state " + filename + " could not be opened");
+
+		vbyte buffer((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		loadState(cpu, vid, pad, buffer.data(), buffer.size());
+	}
+}
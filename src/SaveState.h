@@ -0,0 +1,45 @@
+#pragma once
+
+#include "types.h"
+#include <string>
+
+namespace GBEmu {
+	class Z80;
+	class Video;
+	class Joypad;
+
+	const uint16_t SAVESTATE_VERSION = 1;
+
+	enum SAVESTATE_FLAGS : uint16_t {
+		SAVESTATE_JOYPAD = 1 // the joypad is at the end
+	};
+
+	// at the start of every state. the rest is the cpu (memory included),
+	// the video and maybe the joypad, each in the order its saveState()
+	// writes, with nothing in between.
+	struct SaveStateHeader {
+		char magic[4]; // "GBST"
+		uint16_t version;
+		uint16_t flags;
+		uint32_t size; // the whole state, header included
+		uint32_t reserved;
+		uint64_t romHash; // ROM::gethash(), 0 with no rom
+	};
+
+	// the whole machine, in a fixed layout that's about 25k. with a buffer
+	// that's big enough, saving and loading are a few memcpys, cheap enough
+	// to do every frame.
+
+	// how big a state is, the same every time for a given pad or not
+	size_t getSaveStateSize(bool withJoypad);
+
+	// returns how much of buffer was used. throws if it's too small.
+	size_t saveState(const Z80& cpu, const Video& vid, const Joypad* pad, byte* buffer, size_t size);
+	// throws on a state from another version or another rom, and leaves the
+	// machine alone when it does. a pad in the state is ignored with no pad
+	// to load it into.
+	void loadState(Z80& cpu, Video& vid, Joypad* pad, const byte* buffer, size_t size);
+
+	void saveStateFile(const Z80& cpu, const Video& vid, const Joypad* pad, const std::string& filename);
+	void loadStateFile(Z80& cpu, Video& vid, Joypad* pad, const std::string& filename);
+}
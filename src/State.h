@@ -0,0 +1,85 @@
+#pragma once
+
+#include "types.h"
+#include <stdexcept>
+#include <type_traits>
+
+namespace GBEmu {
+	// only the <cstdint> fixed width types and arrays of them. where int or
+	// size_t is the same type as one of those it can't be told apart, so
+	// write the fixed width name anyway.
+	template <typename T> struct isStateValue {
+		typedef typename std::remove_cv<typename std::remove_all_extents<T>::type>::type U;
+		static const bool value =
+			std::is_same<U, uint8_t>::value || std::is_same<U, int8_t>::value ||
+			std::is_same<U, uint16_t>::value || std::is_same<U, int16_t>::value ||
+			std::is_same<U, uint32_t>::value || std::is_same<U, int32_t>::value ||
+			std::is_same<U, uint64_t>::value || std::is_same<U, int64_t>::value;
+	};
+
+	// components write their state into one of these in whatever order they
+	// like and read it back in the same order. only fixed width integers
+	// and bools go in, so the layout is the same on every compiler. values
+	// are stored as the host has them, which is little endian everywhere
+	// we build. SaveState.h puts the whole machine together.
+	class StateWriter {
+		byte* data;
+		size_t size, pos;
+	public:
+		// into a caller's buffer. with no buffer, only counts.
+		StateWriter(byte* buffer, size_t len) : data(buffer), size(len), pos(0) {}
+		StateWriter() : data(nullptr), size(SIZE_MAX), pos(0) {}
+
+		void write(const void* src, size_t len) {
+			if (len > size - pos)
+				throw std::runtime_error("state doesn't fit");
+			if (data)
+				memcpy(data + pos, src, len);
+			pos += len;
+		}
+
+		template <typename T> void put(const T& v) {
+			static_assert(isStateValue<T>::value, "only fixed width integers go into a state");
+			write(&v, sizeof(v));
+		}
+
+		void put(bool v) {
+			byte b = v;
+			write(&b, 1);
+		}
+
+		size_t getSize() const {
+			return pos;
+		}
+	};
+
+	class StateReader {
+		const byte* data;
+		size_t size, pos;
+	public:
+		StateReader(const vbyte& buffer) : data(buffer.data()), size(buffer.size()), pos(0) {}
+		StateReader(const byte* buffer, size_t len) : data(buffer), size(len), pos(0) {}
+
+		void read(void* dest, size_t len) {
+			if (len > size - pos)
+				throw std::runtime_error("state ends too soon");
+			memcpy(dest, data + pos, len);
+			pos += len;
+		}
+
+		template <typename T> void get(T& v) {
+			static_assert(isStateValue<T>::value, "only fixed width integers come out of a state");
+			read(&v, sizeof(v));
+		}
+
+		void get(bool& v) {
+			byte b;
+			read(&b, 1);
+			v = b != 0;
+		}
+
+		bool atEnd() const {
+			return pos == size;
+		}
+	};
+}
@@ -0,0 +1,74 @@
+#include "Stats.h"
+
+namespace GBEmu {
+	const char* getStatName(STAT s)
+	{
+		static const char* names[STAT_COUNT] = {
+			"instructions",
+			"halted cycles",
+			"mmu slow path",
+			"io hook calls",
+			"bank switches",
+			"frames rendered",
+			"frames skipped"
+		};
+
+		return names[s];
+	}
+
+	Stats::Stats()
+	{
+#if GBEMU_STATS
+		for (int i = 0; i < STAT_COUNT; i++) {
+			counters[i] = 0;
+			baseline[i] = 0;
+		}
+#endif
+	}
+
+	StatsSnapshot Stats::snapshot() const
+	{
+		StatsSnapshot snap;
+		for (int i = 0; i < STAT_COUNT; i++) {
+#if GBEMU_STATS
+			snap.values[i] = counters[i].load(std::memory_order_relaxed) - baseline[i].load(std::memory_order_relaxed);
+#else
+			snap.values[i] = 0;
+#endif
+		}
+
+		return snap;
+	}
+
+	void Stats::reset()
+	{
+#if GBEMU_STATS
+		for (int i = 0; i < STAT_COUNT; i++)
+			baseline[i].store(counters[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+#endif
+	}
+
+	StatsSnapshot Stats::mark() const
+	{
+		StatsSnapshot snap;
+		for (int i = 0; i < STAT_COUNT; i++) {
+#if GBEMU_STATS
+			snap.values[i] = counters[i].load(std::memory_order_relaxed);
+#else
+			snap.values[i] = 0;
+#endif
+		}
+
+		return snap;
+	}
+
+	void Stats::discardSince(const StatsSnapshot& mark)
+	{
+#if GBEMU_STATS
+		for (int i = 0; i < STAT_COUNT; i++) {
+			uint64_t since = counters[i].load(std::memory_order_relaxed) - mark.values[i];
+			baseline[i].store(baseline[i].load(std::memory_order_relaxed) + since, std::memory_order_relaxed);
+		}
+#endif
+	}
+}
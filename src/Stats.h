@@ -0,0 +1,66 @@
+#pragma once
+
+#include "types.h"
+#include <atomic>
+
+// build with GBEMU_STATS=0 to compile all counting out
+#ifndef GBEMU_STATS
+#define GBEMU_STATS 1
+#endif
+
+namespace GBEmu {
+	enum STAT {
+		STAT_INSTRUCTIONS,
+		STAT_HALTED_CYCLES,
+		STAT_MMU_SLOW_PATH, // accesses that went through hooks, watches or the mbc
+		STAT_IO_HOOKS,
+		STAT_BANK_SWITCHES,
+		STAT_FRAMES_RENDERED,
+		STAT_FRAMES_SKIPPED,
+		STAT_COUNT
+	};
+
+	const char* getStatName(STAT s);
+
+	struct StatsSnapshot {
+		uint64_t values[STAT_COUNT];
+
+		uint64_t get(STAT s) const {
+			return values[s];
+		}
+	};
+
+	// counted by the emulation thread only, so bumping a counter is a plain
+	// load and store. other threads can take snapshots and reset at any time.
+	class Stats {
+#if GBEMU_STATS
+		std::atomic<uint64_t> counters[STAT_COUNT];
+		// what counters were at the last reset. only touched by reset()
+		std::atomic<uint64_t> baseline[STAT_COUNT];
+#endif
+	public:
+		Stats();
+
+		Stats(const Stats&) = delete;
+		Stats& operator=(const Stats&) = delete;
+
+		void add(STAT s, uint64_t n = 1) {
+#if GBEMU_STATS
+			counters[s].store(counters[s].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+#endif
+		}
+
+		// since the last reset. all zeros when compiled out.
+		StatsSnapshot snapshot() const;
+
+		// counters aren't touched, so this doesn't race with the emulation thread.
+		// resets from more than one thread at once aren't supported.
+		void reset();
+
+		// the counters as they are, to hand back to discardSince()
+		StatsSnapshot mark() const;
+		// leaves whatever was counted since mark out of snapshots, e.g. a
+		// replay of what was already counted once. same rules as reset().
+		void discardSince(const StatsSnapshot& mark);
+	};
+}
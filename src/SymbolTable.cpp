@@ -0,0 +1,227 @@
+#include "SymbolTable.h"
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <mutex>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+
+namespace GBEmu {
+	// labels don't reach across these: rom0, romx, vram, sram, wram, the rest, hram
+	static int getRegion(word addr)
+	{
+		static const word ends[] = { 0x4000, 0x8000, 0xA000, 0xC000, 0xE000, 0xFF80 };
+		int region = 0;
+		while (region < 6 && addr >= ends[region])
+			region++;
+		return region;
+	}
+
+	static word getBank(word bank, word addr)
+	{
+		return (addr < 0x4000 || addr >= 0x8000) ? 0 : bank;
+	}
+
+	void SymbolTable::loadSym(const std::string& filename)
+	{
+		std::ifstream in(filename);
+		if (!in.is_open())
+			throw std::runtime_error("symbol file " + filename + " could not be opened");
+
+		// appended as they come and sorted once at the end, big files have
+		// tens of thousands of labels
+		vector<bool> touched(banks.size());
+
+		std::string line;
+		while (std::getline(in, line)) {
+			size_t comment = line.find(';');
+			if (comment != std::string::npos)
+				line.erase(comment);
+
+			const char* p = line.c_str();
+			while (isspace((unsigned char)*p))
+				p++;
+
+			char* end;
+			unsigned long bank = strtoul(p, &end, 16);
+			if (end == p || *end != ':')
+				continue;
+			p = end + 1;
+			unsigned long addr = strtoul(p, &end, 16);
+			if (end == p || addr > 0xFFFF || !isspace((unsigned char)*end))
+				continue;
+
+			p = end;
+			while (isspace((unsigned char)*p))
+				p++;
+			const char* nameEnd = p;
+			while (*nameEnd && !isspace((unsigned char)*nameEnd))
+				nameEnd++;
+			if (nameEnd == p)
+				continue;
+
+			word b = getBank(word(bank), word(addr));
+			if (b >= banks.size())
+				banks.resize(b + 1);
+			if (b >= touched.size())
+				touched.resize(b + 1);
+
+			uint32_t name = uint32_t(names.size());
+			names.emplace_back(p, nameEnd);
+			banks[b].push_back(Symbol{ word(addr), name });
+			byName[names.back()] = Location{ b, word(addr) };
+			touched[b] = true;
+		}
+
+		for (size_t b = 0; b < touched.size(); b++) {
+			if (touched[b])
+				sortBank(banks[b]);
+		}
+	}
+
+	std::shared_ptr<const SymbolTable> SymbolTable::loadShared(const vector<std::string>& filenames)
+	{
+		static std::mutex lock;
+		static map<vector<std::string>, std::weak_ptr<const SymbolTable>> loaded;
+
+		std::lock_guard<std::mutex> hold(lock);
+
+		// forget the tables nobody holds anymore
+		for (auto it = loaded.begin(); it != loaded.end();) {
+			if (it->second.expired())
+				it = loaded.erase(it);
+			else
+				++it;
+		}
+
+		auto found = loaded.find(filenames);
+		if (found != loaded.end()) {
+			auto existing = found->second.lock();
+			if (existing)
+				return existing;
+		}
+
+		std::shared_ptr<SymbolTable> table(new SymbolTable());
+		for (auto &f : filenames)
+			table->loadSym(f);
+
+		loaded[filenames] = table;
+		return table;
+	}
+
+	// by address, and of the labels at one address the last one added stays
+	void SymbolTable::sortBank(vector<Symbol>& bank)
+	{
+		std::stable_sort(bank.begin(), bank.end(), [](const Symbol& a, const Symbol& b) {
+			return a.addr < b.addr;
+		});
+
+		size_t out = 0;
+		for (size_t i = 0; i < bank.size(); i++) {
+			if (i + 1 < bank.size() && bank[i + 1].addr == bank[i].addr)
+				continue;
+			bank[out++] = bank[i];
+		}
+		bank.resize(out);
+	}
+
+	void SymbolTable::insert(word bank, word addr, uint32_t name)
+	{
+		if (bank >= banks.size())
+			banks.resize(bank + 1);
+
+		auto &syms = banks[bank];
+		auto it = std::lower_bound(syms.begin(), syms.end(), addr, [](const Symbol& s, word a) {
+			return s.addr < a;
+		});
+
+		if (it != syms.end() && it->addr == addr)
+			it->name = name;
+		else
+			syms.insert(it, Symbol{ addr, name });
+	}
+
+	void SymbolTable::add(word bank, word addr, const std::string& name)
+	{
+		bank = getBank(bank, addr);
+
+		names.push_back(name);
+		insert(bank, addr, uint32_t(names.size() - 1));
+		byName[name] = Location{ bank, addr };
+	}
+
+	bool SymbolTable::empty() const
+	{
+		return byName.empty();
+	}
+
+	size_t SymbolTable::size() const
+	{
+		return byName.size();
+	}
+
+	bool SymbolTable::lookup(word bank, word addr, std::string& name, word& offset) const
+	{
+		bank = getBank(bank, addr);
+		if (bank >= banks.size())
+			return false;
+
+		auto &syms = banks[bank];
+		auto it = std::upper_bound(syms.begin(), syms.end(), addr, [](word a, const Symbol& s) {
+			return a < s.addr;
+		});
+		if (it == syms.begin())
+			return false;
+
+		--it;
+		if (getRegion(it->addr) != getRegion(addr))
+			return false;
+
+		name = names[it->name];
+		offset = addr - it->addr;
+		return true;
+	}
+
+	bool SymbolTable::find(const std::string& name, word& bank, word& addr) const
+	{
+		auto it = byName.find(name);
+		if (it == byName.end())
+			return false;
+
+		bank = it->second.bank;
+		addr = it->second.addr;
+		return true;
+	}
+
+	bool SymbolTable::resolve(const std::string& expr, word& bank, word& addr) const
+	{
+		if (find(expr, bank, addr))
+			return true;
+
+		size_t plus = expr.rfind('+');
+		if (plus == std::string::npos || plus + 1 == expr.size())
+			return false;
+
+		char* end;
+		unsigned long offset = strtoul(expr.c_str() + plus + 1, &end, 10);
+		if (*end || !find(expr.substr(0, plus), bank, addr))
+			return false;
+
+		addr = word(addr + offset);
+		return true;
+	}
+
+	std::string SymbolTable::format(word bank, word addr) const
+	{
+		std::string name;
+		word offset;
+
+		if (lookup(bank, addr, name, offset))
+			return offset ? name + "+" + std::to_string(offset) : name;
+
+		char buf[16];
+		sprintf(buf, "%02X:%04X", bank, addr);
+		return buf;
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "types.h"
+#include <string>
+#include <memory>
+#include <unordered_map>
+
+namespace GBEmu {
+	// for a romx address given with no bank, matches whichever is mapped
+	const word BANK_ANY = 0xFFFF;
+
+	// labels by (bank, address), as rgbds and no$gmb write them to .sym
+	// files. anything outside 0x4000-0x7FFF is bank 0. each bank is a
+	// sorted array, so going from an address to a label is a binary
+	// search, and names are hashed for going back.
+	class SymbolTable {
+		struct Symbol {
+			word addr;
+			uint32_t name; // into names
+		};
+
+		// by bank, sorted by address, one label per address
+		vector<vector<Symbol>> banks;
+		vector<std::string> names;
+
+		struct Location {
+			word bank, addr;
+		};
+		std::unordered_map<std::string, Location> byName;
+
+	public:
+		// "BB:AAAA Label" lines, ; starts a comment. can be called more
+		// than once, later labels at the same address win.
+		void loadSym(const std::string& filename);
+
+		// loads the files once for everyone asking for the same ones, for
+		// as long as someone holds on to the table
+		static std::shared_ptr<const SymbolTable> loadShared(const vector<std::string>& filenames);
+
+		void add(word bank, word addr, const std::string& name);
+		bool empty() const;
+		size_t size() const;
+
+		// the closest label at or before addr in the same bank. offset is
+		// how far past it addr is. false if there's none.
+		bool lookup(word bank, word addr, std::string& name, word& offset) const;
+
+		// where a label is, exactly as named
+		bool find(const std::string& name, word& bank, word& addr) const;
+		// "Label" or "Label+12", what format() gives back
+		bool resolve(const std::string& expr, word& bank, word& addr) const;
+
+		// "Label", "Label+12", or "03:4567" with no label to go by
+		std::string format(word bank, word addr) const;
+
+	private:
+		void insert(word bank, word addr, uint32_t name);
+		static void sortBank(vector<Symbol>& bank);
+	};
+}
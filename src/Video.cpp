@@ -1,44 +1,165 @@
 #include "Video.h"
+#include "HostTrace.h"
+#include <stdexcept>
+#include <climits>
 
-void GBEmu::Video::OnWriteLY(word _a, byte _b)
+namespace GBEmu {
+	// 0 to 255, 3 to 0
+	static const byte ShadeGrey[4] = { 255, 170, 85, 0 };
+
+	// length of each mode, by mode number
+	static const int ModeCycles[4] = { 204, LINE_CYCLES, 80, 172 };
+
+	static word greyTo565(byte g)
+	{
+		return word(((g >> 3) << 11) | ((g >> 2) << 5) | (g >> 3));
+	}
+
+	size_t getRowSize(PIXEL_FORMAT format)
+	{
+		switch (format) {
+		case PF_RGBA8888:
+			return CANVAS_WIDTH * sizeof(Pixel);
+		case PF_RGB565:
+			return CANVAS_WIDTH * 2;
+		case PF_SHADE2:
+			return CANVAS_WIDTH / 4;
+		default:
+			return CANVAS_WIDTH;
+		}
+	}
+}
+
+void GBEmu::Video::OnWriteLY(word, byte)
 {
+	sync();
 	line = 0;
-	mmu->rawwriteb(LY_ADDR, 0);
 }
 
-byte GBEmu::Video::getSCX()
+void GBEmu::Video::OnWriteReg(word addr, byte val)
+{
+	// lines before the write must be drawn with the old values
+	sync();
+
+	// vram/oam come through write watches, which do the write themselves
+	if (addr >= 0xFF00)
+		mmu->rawwriteb(addr, val);
+}
+
+void GBEmu::Video::OnWriteVRAM(word addr, byte val)
+{
+	sync();
+
+	if (addr < 0x9800)
+		tileGen[(addr - VRAM_BASE) >> 4]++;
+
+	if (threaded) {
+		RenderCommand cmd;
+		cmd.type = RC_VRAM;
+		cmd.addr = addr;
+		cmd.val = val;
+		queueRender(cmd);
+	}
+}
+
+byte GBEmu::Video::OnReadReg(word addr)
+{
+	if (addr == LY_ADDR)
+		return getLY();
+	return getSTAT();
+}
+
+int GBEmu::Video::getDot() const
+{
+	int dot = modeCounter;
+	if (mode == 3) dot += ModeCycles[2];
+	else if (mode == 0) dot += ModeCycles[2] + ModeCycles[3];
+	return dot;
+}
+
+// where the video is at right now. in catch-up mode this is worked out from the
+// cycles since the last sync, so reads don't have to run the video.
+void GBEmu::Video::getPosition(byte &ly, int &curmode) const
+{
+	if (!catchup) {
+		ly = line;
+		curmode = mode;
+		return;
+	}
+
+	if (!getIsLCDOn()) {
+		ly = line;
+		curmode = 0;
+		return;
+	}
+
+	uint32_t dot = getDot() + (cpu->clock.machine - lastSync);
+	ly = (line + dot / LINE_CYCLES) % 154;
+	dot %= LINE_CYCLES;
+
+	if (ly >= 144)
+		curmode = 1;
+	else if (dot < uint32_t(ModeCycles[2]))
+		curmode = 2;
+	else if (dot < uint32_t(ModeCycles[2] + ModeCycles[3]))
+		curmode = 3;
+	else
+		curmode = 0;
+}
+
+byte GBEmu::Video::getLY() const
+{
+	byte ly;
+	int curmode;
+	getPosition(ly, curmode);
+	return ly;
+}
+
+byte GBEmu::Video::getSTAT() const
+{
+	byte ly;
+	int curmode;
+	getPosition(ly, curmode);
+
+	byte stat = mmu->rawreadb(STAT_ADDR) & 0x78; // interrupt selects
+	if (ly == mmu->rawreadb(LYC_ADDR))
+		stat |= 0x04;
+
+	return 0x80 | stat | curmode;
+}
+
+byte GBEmu::Video::getSCX() const
 {
 	return mmu->rawreadb(SCX_ADDR);
 }
 
-byte GBEmu::Video::getSCY()
+byte GBEmu::Video::getSCY() const
 {
 	return mmu->rawreadb(SCY_ADDR);
 }
 
-byte GBEmu::Video::getLCDC()
+byte GBEmu::Video::getLCDC() const
 {
 	return mmu->rawreadb(LCDC_ADDR);
 }
 
-bool GBEmu::Video::getBGMap()
+bool GBEmu::Video::getBGMap() const
 {
 	return getLCDC() & 0x08; // bit 4
 }
 
-bool GBEmu::Video::getIsLCDOn()
+bool GBEmu::Video::getIsLCDOn() const
 {
 	return getLCDC() & 0x80;
 }
 
-bool GBEmu::Video::getBGTile()
+bool GBEmu::Video::getBGTile() const
 {
 	return getLCDC() & 0x10; // fifth bit
 }
 
-byte GBEmu::Video::getTilePx(bool bank1, word tile, byte y, byte x)
+word GBEmu::Video::getTileAddr(bool bank1, word tile, byte y) const
 {
-	x = 7 - x;
 	word tile_reladdr = tile * 16; // tile base address (16 bytes/tile)
 	word row = y * 2; // 2 bytes per row
 
@@ -46,39 +167,40 @@ byte GBEmu::Video::getTilePx(bool bank1, word tile, byte y, byte x)
 	if (bank1)
 		displacement = 0x800;
 
+	return tile_reladdr + row + VRAM_BASE + displacement;
+}
+
+byte GBEmu::Video::getTilePx(bool bank1, word tile, byte y, byte x)
+{
+	x = 7 - x;
+	word addr = getTileAddr(bank1, tile, y);
+
 	byte bit = (1 << x);
-	byte bitL = (mmu->readb(tile_reladdr + row + VRAM_BASE + displacement) & bit) >> x;
-	byte bitH = (mmu->readb(tile_reladdr + row + VRAM_BASE + 1 + displacement) & bit) >> x;
+	byte bitL = (mmu->peekb(addr) & bit) >> x;
+	byte bitH = (mmu->peekb(addr + 1) & bit) >> x;
 
 	byte px = (bitH << 1) | bitL;
 	return px;
 }
 
-GBEmu::Pixel GBEmu::Video::getBGPalColor(byte bg)
+byte GBEmu::Video::getBGPalShade(byte bg)
 {
 	byte bgpal = mmu->rawreadb(BGPAL_ADDR);
 	// first 2 bits
-	byte brightness = (bgpal >> (bg * 2)) & 0x03;
-	// 0 to 255, 3 to 0
-	byte pxbrightness = byte(255.0 - 255.0 / 3.0 * brightness);
-
-	return Pixel{
-		pxbrightness, pxbrightness, pxbrightness, 255
-	};
+	return (bgpal >> (bg * 2)) & 0x03;
 }
 
 void GBEmu::Video::renderScanDebug(VIDEO_DEBUGMODE debug)
 {
-	word canvasoffs = line * 160;
 	word tile = (line >> 3) * 20 + ((debug == TILE_B) ? 128 : 0);
 
 	word x = 0;
 	for (int i = 0; i < 160; i++) {
-		auto px = getBGPalColor(getTilePx(debug == TILE_B, tile + (x / 8), line % 8, x % 8));
-
-		canvas[canvasoffs + x] = px;
+		scanline[x] = getBGPalShade(getTilePx(debug == TILE_B, tile + (x / 8), line % 8, x % 8));
 		x++;
 	}
+
+	emitScan(target, line, scanline);
 }
 
 void GBEmu::Video::renderScanDebugBG(VIDEO_DEBUGMODE debug)
@@ -90,14 +212,11 @@ void GBEmu::Video::renderScanDebugBG(VIDEO_DEBUGMODE debug)
 
 	byte tile = mmu->rawreadb(VRAM_BASE + mapoffs + lineoffs);
 	
-	word canvasoffs = line * 160;
+	byte grey[CANVAS_WIDTH];
 
 	word x = 0;
 	for (int i = 0; i < 160; i++) {
-		auto px = Pixel { tile, tile, tile, 255 };
-
-		canvas[canvasoffs] = px;
-		canvasoffs++;
+		grey[i] = tile;
 		x++;
 		if (x == 8) {
 			x = 0;
@@ -106,44 +225,258 @@ void GBEmu::Video::renderScanDebugBG(VIDEO_DEBUGMODE debug)
 		}
 	}
 
+	emitScanGrey(grey);
 }
 
-// a painfully direct translation
-void GBEmu::Video::renderScan()
+uint32_t GBEmu::Video::getTileGen(word addr)
+{
+	if (addr >= VRAM_BASE && addr < 0x9800)
+		return tileGen[(addr - VRAM_BASE) >> 4];
+
+	// not tile data (signed tiles can land in rom), so there's no generation
+	// to go by. peeked, the ppu doesn't go through hooks, stats or coverage.
+	return 0x80000000 | packWord(mmu->peekb(addr), mmu->peekb(addr + 1));
+}
+
+// fnv-1a over everything renderBackground() is going to look at
+uint64_t GBEmu::Video::getScanKey(const ScanlineRegs& regs)
+{
+	uint64_t h = 14695981039346656037ull;
+	auto mix = [&h](uint32_t v) {
+		h ^= v;
+		h *= 1099511628211ull;
+	};
+
+	mix(regs.lcdc);
+	mix(regs.scx);
+	mix(regs.scy);
+	mix(regs.bgp);
+
+	bool tileset = regs.lcdc & 0x10;
+	word mapoffs = (regs.lcdc & 0x08) ? 0x1C00 : 0x1800;
+	mapoffs += (((regs.line + regs.scy) & 255) >> 3) << 5;
+	byte y = (regs.line + regs.scy) & 7;
+	word lineoffs = regs.scx >> 3;
+
+	// same tile walk as renderBackground(): 21 fetches
+	for (int i = 0; i <= CANVAS_WIDTH / 8; i++) {
+		char tile = mmu->rawreadb(VRAM_BASE + mapoffs + ((lineoffs + i) & 31));
+		// same as renderBackground
+		if (tileset && (CHAR_MIN < 0 || byte(tile) < 128)) {
+			tile += 128;
+		}
+
+		mix(byte(tile));
+		mix(getTileGen(getTileAddr(tileset, tile, y)));
+	}
+
+	return h;
+}
+
+GBEmu::ScanlineRegs GBEmu::Video::getScanlineRegs() const
+{
+	ScanlineRegs regs;
+	regs.line = line;
+	regs.lcdc = getLCDC();
+	regs.scx = getSCX();
+	regs.scy = getSCY();
+	regs.bgp = mmu->rawreadb(BGPAL_ADDR);
+	regs.rombank = mmu->getROMBank();
+	return regs;
+}
+
+// a painfully direct translation.
+// only looks at regs and vram, so the render thread can use it on its own copies.
+void GBEmu::Video::renderBackground(const ScanlineRegs& regs, const byte* vram, byte* shades) const
 {
-	word mapoffs = getBGMap() ? 0x1C00 : 0x1800;
-	mapoffs += (((line + getSCY()) & 255) >> 3) << 5;
+	bool tileset = regs.lcdc & 0x10;
 
-	byte y = (line + getSCY()) & 7; 
-	byte x = getSCX() & 7;
+	word mapoffs = (regs.lcdc & 0x08) ? 0x1C00 : 0x1800;
+	mapoffs += (((regs.line + regs.scy) & 255) >> 3) << 5;
 
-	word canvasoffs = line * 160;
+	byte y = (regs.line + regs.scy) & 7; 
+	byte x = regs.scx & 7;
 
-	word lineoffs = getSCX() >> 3;
-	char tile = mmu->rawreadb(VRAM_BASE + mapoffs + lineoffs);
+	word lineoffs = regs.scx >> 3;
+	char tile = vram[mapoffs + lineoffs];
 
 	// 0 to 0x8800 if tilset #1 is enabled
 	// and 128 to 0x9000.
+	// tile < 128 on a char, always true where char is signed, spelled out
+	// so it doesn't warn
 	word wadd = 128;
-	if (getBGTile() && tile < 128) {
+	if (tileset && (CHAR_MIN < 0 || byte(tile) < 128)) {
 		tile += wadd;
 	}
 
+	// the row of the tile we're on. signed tile numbers can land it
+	// in 0x7800 -> 0x7FFF, which is rom.
+	byte rowL, rowH;
+	auto fetchRow = [&]() {
+		word addr = getTileAddr(tileset, tile, y);
+		if (addr >= VRAM_BASE) {
+			rowL = vram[addr - VRAM_BASE];
+			rowH = vram[addr - VRAM_BASE + 1];
+		}
+		else {
+			rowL = mmu->readROM(addr, regs.rombank);
+			rowH = mmu->readROM(addr + 1, regs.rombank);
+		}
+	};
+	fetchRow();
+
 	// draw the scanline
 	for (int i = 0; i < 160; i++) {
-		auto px = getBGPalColor(getTilePx(getBGTile(), tile, y, x));
-
-		canvas[canvasoffs] = px;
-		canvasoffs += 1;
+		byte bit = 7 - x;
+		byte px = (((rowH >> bit) & 1) << 1) | ((rowL >> bit) & 1);
+		shades[i] = (regs.bgp >> (px * 2)) & 0x03;
 
 		x++;
 		if (x == 8) {
 			x = 0;
 			lineoffs = (lineoffs + 1) & 31;
-			tile = mmu->rawreadb(VRAM_BASE + mapoffs + lineoffs);
-			if (getBGTile() && tile < 128) { // signed tile
+			tile = vram[mapoffs + lineoffs];
+			if (tileset && (CHAR_MIN < 0 || byte(tile) < 128)) { // signed tile
 				tile += wadd;
 			}
+			fetchRow();
+		}
+	}
+}
+
+void GBEmu::Video::renderScan()
+{
+	ScanlineRegs regs = getScanlineRegs();
+
+	if (threaded) {
+		RenderCommand cmd;
+		cmd.type = RC_LINE;
+		cmd.regs = regs;
+		queueRender(cmd);
+		return;
+	}
+
+	TRACE_SCOPE("render line");
+
+	LineCacheEntry *cached = nullptr;
+	uint64_t key = 0;
+
+	if (!lineCache.empty()) {
+		cached = &lineCache[line];
+		key = getScanKey(regs);
+
+		if (cached->valid && cached->key == key) {
+			lineCacheStats.hits++;
+
+			bool sameTarget = cached->target.data == target.data &&
+				cached->target.stride == target.stride &&
+				cached->target.format == target.format;
+
+			if (!sameTarget) {
+				emitScan(target, line, cached->shades);
+				cached->target = target;
+			}
+			return;
+		}
+
+		lineCacheStats.misses++;
+	}
+
+	renderBackground(regs, mmu->getVRAM(), scanline);
+
+	if (cached) {
+		cached->valid = true;
+		cached->key = key;
+		cached->target = target;
+		memcpy(cached->shades, scanline, CANVAS_WIDTH);
+	}
+
+	emitScan(target, line, scanline);
+}
+
+void GBEmu::Video::emitScan(const FrameBuffer& fb, byte ly, const byte* shades)
+{
+	byte* row = (byte*)fb.data + ly * fb.stride;
+
+	switch (fb.format) {
+	case PF_RGBA8888: {
+		Pixel* out = (Pixel*)row;
+		for (int i = 0; i < CANVAS_WIDTH; i++) {
+			byte g = ShadeGrey[shades[i]];
+			out[i] = Pixel{ g, g, g, 255 };
+		}
+		break;
+	}
+	case PF_RGB565: {
+		word* out = (word*)row;
+		for (int i = 0; i < CANVAS_WIDTH; i++)
+			out[i] = greyTo565(ShadeGrey[shades[i]]);
+		break;
+	}
+	case PF_GREY8:
+		for (int i = 0; i < CANVAS_WIDTH; i++)
+			row[i] = ShadeGrey[shades[i]];
+		break;
+	case PF_SHADE8:
+		memcpy(row, shades, CANVAS_WIDTH);
+		break;
+	case PF_SHADE2:
+		for (int i = 0; i < CANVAS_WIDTH; i += 4)
+			row[i >> 2] = (shades[i] << 6) | (shades[i + 1] << 4) | (shades[i + 2] << 2) | shades[i + 3];
+		break;
+	}
+}
+
+// debug views that aren't shades to begin with
+void GBEmu::Video::emitScanGrey(const byte* grey)
+{
+	byte* row = (byte*)target.data + line * target.stride;
+
+	switch (target.format) {
+	case PF_RGBA8888: {
+		Pixel* out = (Pixel*)row;
+		for (int i = 0; i < CANVAS_WIDTH; i++)
+			out[i] = Pixel{ grey[i], grey[i], grey[i], 255 };
+		break;
+	}
+	case PF_RGB565: {
+		word* out = (word*)row;
+		for (int i = 0; i < CANVAS_WIDTH; i++)
+			out[i] = greyTo565(grey[i]);
+		break;
+	}
+	case PF_GREY8:
+		memcpy(row, grey, CANVAS_WIDTH);
+		break;
+	default:
+		for (int i = 0; i < CANVAS_WIDTH; i++)
+			scanline[i] = 3 - (grey[i] >> 6);
+		emitScan(target, line, scanline);
+	}
+}
+
+void GBEmu::Video::refresh()
+{
+	if (threaded) {
+		RenderCommand cmd;
+		cmd.type = RC_FRAME;
+		queueRender(cmd);
+	}
+	else
+		runFrameHooks(target);
+}
+
+void GBEmu::Video::runFrameHooks(const FrameBuffer& fb)
+{
+	TRACE_SCOPE("frame hooks");
+
+	for (auto f : OnFrame) {
+		f(fb);
+	}
+
+	if (fb.format == PF_RGBA8888 && fb.stride == getRowSize(PF_RGBA8888)) {
+		for (auto f : OnRefresh) {
+			f((const Pixel*)fb.data);
 		}
 	}
 }
@@ -151,17 +484,64 @@ void GBEmu::Video::renderScan()
 GBEmu::Video::Video(MMU * mem)
 {
 	LY = bind(&Video::OnWriteLY, this, std::placeholders::_1, std::placeholders::_2);
+	VRAMWrite = bind(&Video::OnWriteVRAM, this, std::placeholders::_1, std::placeholders::_2);
+	RegRead = bind(&Video::OnReadReg, this, std::placeholders::_1);
 	
 	mmu = mem;
+	cpu = nullptr;
+	catchup = false;
+	lastSync = 0;
+	nextEventAt = 0;
+	threaded = false;
+	renderQueued = 0;
+	renderDone = 0;
+	renderSleeping = false;
+	targetMoved = false;
 	
 	mmu->addWriteHook(LY_ADDR, &LY);
+	mmu->addWriteWatch(VRAM_BASE, VRAM_END, &VRAMWrite);
+	mmu->addReadHook(LY_ADDR, &RegRead);
+	mmu->addReadHook(STAT_ADDR, &RegRead);
+	// getLY() and getSTAT() don't sync, so peeking is fine
+	mmu->addPeekHook(LY_ADDR, &RegRead);
+	mmu->addPeekHook(STAT_ADDR, &RegRead);
 	// internalLY = 0;
 
 	modeCounter = 0;
 	mode = 0;
 	line = 0;
+	debugMode = NORMAL;
+
+	memset(tileGen, 0, sizeof(tileGen));
+	lineCacheStats = LineCacheStats{ 0, 0 };
 
 	memset(canvas, 255, sizeof(canvas));
+	resetFrameBuffer();
+
+	frameRequested = false;
+	setFrameSkip(0);
+}
+
+GBEmu::Video::Video(Z80 * pr) : Video(&pr->mmu)
+{
+	cpu = pr;
+	catchup = true;
+	lastSync = cpu->clock.machine;
+	nextEventAt = lastSync + cyclesToVBlank();
+
+	RegWrite = bind(&Video::OnWriteReg, this, std::placeholders::_1, std::placeholders::_2);
+
+	mmu->addWriteHook(LCDC_ADDR, &RegWrite);
+	mmu->addWriteHook(SCX_ADDR, &RegWrite);
+	mmu->addWriteHook(SCY_ADDR, &RegWrite);
+	mmu->addWriteHook(BGPAL_ADDR, &RegWrite);
+	mmu->addWriteWatch(OAM_BASE, OAM_END, &RegWrite);
+
+}
+
+GBEmu::Video::~Video()
+{
+	setThreaded(false);
 }
 
 void GBEmu::Video::addRefreshHook(RefreshHook hook)
@@ -169,77 +549,389 @@ void GBEmu::Video::addRefreshHook(RefreshHook hook)
 	OnRefresh.push_back(hook);
 }
 
+void GBEmu::Video::addFrameHook(FrameHook hook)
+{
+	OnFrame.push_back(hook);
+}
+
+void GBEmu::Video::addVBlankHook(VBlankHook hook)
+{
+	OnVBlank.push_back(hook);
+}
+
+void GBEmu::Video::setFrameBuffer(void * data, size_t stride, PIXEL_FORMAT format)
+{
+	if (stride < getRowSize(format))
+		throw std::runtime_error("frame buffer stride is smaller than a row");
+
+	FrameBuffer fb{ data, stride, format };
+
+	// a frame hook on the render thread choosing where the next frame goes
+	if (threaded && std::this_thread::get_id() == renderThread.get_id()) {
+		renderTarget = fb;
+
+		std::lock_guard<std::mutex> lock(movedMutex);
+		movedTarget = fb;
+		movedAt = renderDone.load(std::memory_order_relaxed) + 1;
+		targetMoved.store(true, std::memory_order_release);
+		return;
+	}
+
+	target = fb;
+
+	if (threaded) {
+		RenderCommand cmd;
+		cmd.type = RC_TARGET;
+		cmd.target = fb;
+		queueRender(cmd);
+		targetSetAt = renderQueued;
+	}
+}
+
+void GBEmu::Video::takeMovedTarget()
+{
+	if (!targetMoved.load(std::memory_order_acquire))
+		return;
+
+	std::lock_guard<std::mutex> lock(movedMutex);
+	// otherwise our own RC_TARGET, still queued, replaces it
+	if (movedAt > targetSetAt)
+		target = movedTarget;
+	targetMoved.store(false, std::memory_order_relaxed);
+}
+
+void GBEmu::Video::resetFrameBuffer()
+{
+	setFrameBuffer(canvas, getRowSize(PF_RGBA8888), PF_RGBA8888);
+}
+
+const GBEmu::FrameBuffer & GBEmu::Video::getFrameBuffer()
+{
+	// asked from a frame hook
+	if (threaded && std::this_thread::get_id() == renderThread.get_id())
+		return renderTarget;
+
+	takeMovedTarget();
+	return target;
+}
+
+void GBEmu::Video::setFrameSkip(int n)
+{
+	frameSkip = n;
+	skipCounter = 0;
+	beginFrame();
+}
+
+void GBEmu::Video::requestFrame()
+{
+	frameRequested = true;
+}
+
+bool GBEmu::Video::isDrawingFrame() const
+{
+	return drawing;
+}
+
+void GBEmu::Video::setLineCache(bool enabled)
+{
+	if (!enabled)
+		lineCache.clear();
+	else if (lineCache.empty())
+		lineCache.assign(CANVAS_HEIGHT, LineCacheEntry{});
+}
+
+GBEmu::LineCacheStats GBEmu::Video::getLineCacheStats() const
+{
+	return lineCacheStats;
+}
+
+void GBEmu::Video::resetLineCacheStats()
+{
+	lineCacheStats = LineCacheStats{ 0, 0 };
+}
+
+void GBEmu::Video::saveState(StateWriter& out) const
+{
+	out.put(lastSync);
+	out.put(nextEventAt);
+	out.put(int32_t(modeCounter));
+	out.put(byte(mode));
+	out.put(line);
+	out.put(int32_t(skipCounter));
+	out.put(frameRequested);
+	out.put(drawing);
+}
+
+void GBEmu::Video::loadState(StateReader& in)
+{
+	int32_t counter, skip;
+	byte m;
+
+	in.get(lastSync);
+	in.get(nextEventAt);
+	in.get(counter);
+	in.get(m);
+	in.get(line);
+	in.get(skip);
+	in.get(frameRequested);
+	in.get(drawing);
+
+	modeCounter = counter;
+	mode = m;
+	skipCounter = skip;
+
+	// cached lines were keyed on tile generations, not on what vram held
+	for (auto &entry : lineCache)
+		entry.valid = false;
+
+	// the render thread is idle once it's caught up, and the next command
+	// it takes publishes the new copy
+	if (threaded) {
+		waitForRender();
+		memcpy(renderVRAM, mmu->getVRAM(), sizeof(renderVRAM));
+	}
+}
+
+void GBEmu::Video::beginFrame()
+{
+	if (frameSkip == FRAMESKIP_ONDEMAND) {
+		drawing = frameRequested;
+		frameRequested = false;
+		return;
+	}
+
+	drawing = skipCounter == 0;
+	skipCounter = skipCounter >= frameSkip ? 0 : skipCounter + 1;
+}
+
+void GBEmu::Video::setDebugMode(VIDEO_DEBUGMODE debug)
+{
+	debugMode = debug;
+}
+
+void GBEmu::Video::setThreaded(bool enabled)
+{
+	if (enabled == threaded)
+		return;
+
+	if (enabled) {
+		memcpy(renderVRAM, mmu->getVRAM(), sizeof(renderVRAM));
+		renderTarget = target;
+		renderQueue.reset(new SPSCRing<RenderCommand, RENDER_QUEUE_SIZE>());
+		renderQueued = 0;
+		renderDone = 0;
+		targetMoved = false;
+		targetSetAt = 0;
+
+		threaded = true;
+		renderThread = std::thread(&Video::renderLoop, this);
+	}
+	else {
+		RenderCommand cmd;
+		cmd.type = RC_QUIT;
+		queueRender(cmd);
+		renderThread.join();
+		takeMovedTarget();
+
+		threaded = false;
+		renderQueue.reset();
+	}
+}
+
+bool GBEmu::Video::isThreaded() const
+{
+	return threaded;
+}
+
+void GBEmu::Video::waitForRender()
+{
+	if (!threaded)
+		return;
+
+	while (renderDone.load(std::memory_order_acquire) != renderQueued)
+		std::this_thread::yield();
+
+	// so whatever the cpu side draws next goes where the frame hooks said
+	takeMovedTarget();
+}
+
+void GBEmu::Video::queueRender(const RenderCommand& cmd)
+{
+	// the render thread is behind, let it catch up
+	while (!renderQueue->push(cmd))
+		std::this_thread::yield();
+
+	renderQueued++;
+
+	// pairs with the fence in renderLoop: either it sees the push or we see
+	// it going to sleep
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (renderSleeping.load(std::memory_order_relaxed)) {
+		std::lock_guard<std::mutex> lock(renderMutex);
+		renderWake.notify_one();
+	}
+}
+
+void GBEmu::Video::renderLoop()
+{
+	RenderCommand cmd;
+	int idle = 0;
+
+	HostTrace::setThreadName("render");
+
+	while (true) {
+		if (!renderQueue->pop(cmd)) {
+			// spin for a bit, lines come in bursts, then sleep until the
+			// next command
+			if (++idle > 64) {
+				std::unique_lock<std::mutex> lock(renderMutex);
+				renderSleeping.store(true, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				renderWake.wait(lock, [this] { return !renderQueue->empty(); });
+				renderSleeping.store(false, std::memory_order_relaxed);
+				idle = 0;
+			}
+			continue;
+		}
+
+		idle = 0;
+
+		switch (cmd.type) {
+		case RC_VRAM:
+			renderVRAM[cmd.addr - VRAM_BASE] = cmd.val;
+			break;
+		case RC_LINE: {
+			TRACE_SCOPE("render line");
+			renderBackground(cmd.regs, renderVRAM, renderScanline);
+			emitScan(renderTarget, cmd.regs.line, renderScanline);
+			break;
+		}
+		case RC_TARGET:
+			renderTarget = cmd.target;
+			break;
+		case RC_FRAME:
+			runFrameHooks(renderTarget);
+			break;
+		}
+
+		renderDone.store(renderDone.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+
+		if (cmd.type == RC_QUIT)
+			return;
+	}
+}
+
 void GBEmu::Video::updateTimer(int cpuCycles, Z80 *pr, VIDEO_DEBUGMODE debug)
+{
+	debugMode = debug;
+
+	if (catchup) {
+		sync();
+		return;
+	}
+
+	cpu = pr;
+	if (!getIsLCDOn()) return;
+	advance(cpuCycles);
+}
+
+void GBEmu::Video::sync()
+{
+	if (!catchup) return;
+
+	uint32_t now = cpu->clock.machine;
+	uint32_t cycles = now - lastSync;
+	lastSync = now;
+
+	if (getIsLCDOn())
+		advance(cycles);
+
+	nextEventAt = now + cyclesToVBlank();
+}
+
+uint32_t GBEmu::Video::cyclesToVBlank() const
+{
+	int dot = getDot();
+
+	if (mode == 1)
+		return (154 - line) * LINE_CYCLES - dot + 144 * LINE_CYCLES;
+	return (144 - line) * LINE_CYCLES - dot;
+}
+
+void GBEmu::Video::advance(uint32_t cycles)
 {
 	// 4 cpu cycles = a bunch of time in Hz depending on what's up
 	// we've got to set up that 144 and onward is the v-blank period
 	// and "one" of the LY counter is an amount of cpu cycles
-	// v-blank lasts  ~1.1 millisecs so...
-	/*constexpr auto ly_per_ms = (153 - 144) / 1.1;
-	auto ly_total = pr->msPerCycle() * cpuCycles / ly_per_ms;
-	internalLY += ly_total;
-	internalLY = fmod(internalLY, 154.0);
-	
-	well actually we don't need it as per below. foolish me*/
 
 	// "_modeclock" in 
 	// http://imrannazar.com/GameBoy-Emulation-in-JavaScript:-GPU-Timings
 
-	if (!getIsLCDOn()) return;
+	// leftover cycles carry into the next mode, so any amount of cycles
+	// can be caught up with in one go. a whole frame with no syncs in between
+	// ends up drawing its 144 lines right here, back to back.
+	modeCounter += cycles;
 
-	modeCounter += cpuCycles;
+	while (modeCounter >= ModeCycles[mode]) {
+		modeCounter -= ModeCycles[mode];
 
-	switch (mode) {
-	case 2: // OAM access
-		if (modeCounter >= 80) {
+		switch (mode) {
+		case 2: // OAM access
 			mode = 3;
-			modeCounter = 0;
-		}
-	case 3: // VRAM access
+			break;
+		case 3: // VRAM access
 
-		// admittedly, I'd have understood that 
-		// in practice it should dictate the current pixel of this scanline, or something.
-		// may be important for some abusive demos.
-		if (modeCounter >= 172) {
+			// admittedly, I'd have understood that 
+			// in practice it should dictate the current pixel of this scanline, or something.
+			// may be important for some abusive demos.
 			mode = 0;
-			modeCounter = 0;
-			
-			if (debug == TILE || debug == TILE_B)
-				renderScanDebug(debug);
-			else if (debug == TILE_M0 || debug == TILE_M1)
-				renderScanDebugBG(debug);
-			else
-				renderScan();
-		}
-	case 0: // H-blank
-		if (modeCounter >= 204) {
-			modeCounter = 0;
+
+			if (drawing) {
+				if (debugMode != NORMAL) {
+					// debug views overwrite whatever the cache thinks is in the target
+					if (!lineCache.empty())
+						lineCache[line].valid = false;
+
+					// and are drawn here, after anything the render thread still has to do
+					waitForRender();
+				}
+
+				if (debugMode == TILE || debugMode == TILE_B)
+					renderScanDebug(debugMode);
+				else if (debugMode == TILE_M0 || debugMode == TILE_M1)
+					renderScanDebugBG(debugMode);
+				else
+					renderScan();
+			}
+			break;
+		case 0: // H-blank
 			line++;
 
 			// vblank
 			if (line == 144) // matches LY >= 144
 			{
 				mode = 1;
-				
-				for (auto f: OnRefresh) {
-					f(canvas);
-				}
 
-				pr->runInterrupt(Z80::int_vblank);
+				if (drawing)
+					refresh();
+
+				mmu->stats.add(drawing ? STAT_FRAMES_RENDERED : STAT_FRAMES_SKIPPED);
+				cpu->runInterrupt(Z80::int_vblank);
+
+				for (auto &hook : OnVBlank)
+					hook();
 			}
 			else
 				mode = 2;
-		}
-	case 1: // V-blank
-		if (modeCounter >= 456) {
-			modeCounter = 0;
+			break;
+		case 1: // V-blank
 			line++;
 			if (line > 153) {
 				mode = 2;
 				line = 0;
+				beginFrame();
 			}
+			break;
 		}
 	}
-
-	mmu->rawwriteb(LY_ADDR, line);
 }
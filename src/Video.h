@@ -1,15 +1,28 @@
 #pragma once
 
 #include "Z80.h"
+#include "SPSCRing.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 namespace GBEmu {
 	const word LY_ADDR = 0xFF44;
+	const word LYC_ADDR = 0xFF45;
 	const word SCX_ADDR = 0xFF43;
 	const word SCY_ADDR = 0xFF42;
 	const word LCDC_ADDR = 0xFF40;
+	const word STAT_ADDR = 0xFF41;
 	const word BGPAL_ADDR = 0xFF47;
 
 	const word VRAM_BASE = 0x8000;
+	const word VRAM_END = 0x9FFF;
+	const word OAM_BASE = 0xFE00;
+	const word OAM_END = 0xFE9F;
+
+	// in cpu cycles
+	const int LINE_CYCLES = 456;
+	const int FRAME_CYCLES = LINE_CYCLES * 154;
 
 	const word CANVAS_WIDTH = 160;
 	const word CANVAS_HEIGHT = 144;
@@ -23,6 +36,21 @@ namespace GBEmu {
 		TILE_M1
 	};
 
+	// render only the frames asked for through requestFrame()
+	const int FRAMESKIP_ONDEMAND = -1;
+
+	// everything a background line depends on besides vram
+	struct ScanlineRegs {
+		byte line;
+		byte lcdc, scx, scy, bgp;
+		word rombank; // tile data can wander into rom, see renderBackground()
+	};
+
+	struct LineCacheStats {
+		uint64_t hits;
+		uint64_t misses;
+	};
+
 	typedef union {
 		struct {
 			byte r;
@@ -33,41 +61,243 @@ namespace GBEmu {
 		unsigned int val;
 	} Pixel;
 
+	enum PIXEL_FORMAT {
+		PF_RGBA8888, // a Pixel per pixel
+		PF_RGB565, // 16 bits per pixel, native endianness
+		PF_GREY8, // a byte per pixel, 255 is white
+		PF_SHADE8, // a byte per pixel, dmg shade 0 (white) to 3 (black)
+		PF_SHADE2 // 4 pixels per byte, leftmost pixel in the upper 2 bits
+	};
+
+	// bytes needed by a row of the given format
+	size_t getRowSize(PIXEL_FORMAT format);
+
+	// where the video renders to. stride is in bytes and may be
+	// larger than the row size, e.g. a slot inside a bigger buffer.
+	struct FrameBuffer {
+		void *data;
+		size_t stride;
+		PIXEL_FORMAT format;
+	};
+
+	// only called while rendering to a packed PF_RGBA8888 buffer
 	typedef function<void(const Pixel* px)> RefreshHook;
+	typedef function<void(const FrameBuffer& fb)> FrameHook;
+	// every frame, skipped or not, on the cpu's thread
+	typedef function<void()> VBlankHook;
 
 	class Video {
 		MMU *mmu;
 
-		void OnWriteLY(word _a, byte _b);
+		// catch-up mode: the cpu whose clock we follow
+		Z80 *cpu;
+		bool catchup;
+		uint32_t lastSync;
+		uint32_t nextEventAt;
+
+		void OnWriteLY(word, byte);
+		void OnWriteReg(word addr, byte val);
+		void OnWriteVRAM(word addr, byte val);
+		byte OnReadReg(word addr);
 
 		Pixel canvas[CANVAS_SIZE];
+		FrameBuffer target;
+
+		// palette-applied shades of the scanline being drawn
+		byte scanline[CANVAS_WIDTH];
 
 		// double internalLY;
 		WriteHook LY; // FF44
+		WriteHook RegWrite; // LCDC, SCX, SCY, BGP and OAM
+		WriteHook VRAMWrite;
+		ReadHook RegRead; // LY, STAT. never stored, worked out when read
 
 		int modeCounter;
 		int mode;
 		byte line;
 
-		byte getSCX();
-		byte getSCY();
+		// frames to skip after each drawn frame, or FRAMESKIP_ONDEMAND
+		int frameSkip;
+		int skipCounter;
+		bool frameRequested;
+
+		// is the current frame going to be looked at?
+		bool drawing;
+		void beginFrame();
+
+		VIDEO_DEBUGMODE debugMode;
+
+		// bumped on every write to a tile's data, 0x8000 -> 0x97FF
+		uint32_t tileGen[384];
+
+		// output of each line in the last drawn frame, keyed by a hash of its inputs
+		struct LineCacheEntry {
+			bool valid;
+			uint64_t key;
+			FrameBuffer target; // where it was last emitted to
+			byte shades[CANVAS_WIDTH];
+		};
+		vector<LineCacheEntry> lineCache;
+		LineCacheStats lineCacheStats;
+
+		uint64_t getScanKey(const ScanlineRegs& regs);
+		uint32_t getTileGen(word addr);
+
+		// threaded mode: the cpu side logs what each line needs into renderQueue
+		// and renderThread turns it into pixels using its own copy of vram.
+		enum {
+			RC_VRAM,
+			RC_LINE,
+			RC_TARGET,
+			RC_FRAME,
+			RC_QUIT
+		};
+
+		struct RenderCommand {
+			byte type;
+			byte val;
+			word addr;
+			union {
+				ScanlineRegs regs;
+				FrameBuffer target;
+			};
+		};
+
+		static const size_t RENDER_QUEUE_SIZE = 0x8000;
+
+		bool threaded;
+		std::unique_ptr<SPSCRing<RenderCommand, RENDER_QUEUE_SIZE>> renderQueue;
+		std::thread renderThread;
+		uint64_t renderQueued;
+		std::atomic<uint64_t> renderDone;
+		// the render thread sleeps on renderWake once the queue has been
+		// empty for a while, and queueRender() wakes it
+		std::mutex renderMutex;
+		std::condition_variable renderWake;
+		std::atomic<bool> renderSleeping;
+
+		// owned by the render thread while it runs
+		FrameBuffer renderTarget;
+		byte renderVRAM[0x2000];
+		byte renderScanline[CANVAS_WIDTH];
+
+		// a frame hook moving renderTarget leaves it here for the cpu side.
+		// it's only taken if it came after the cpu's own last setFrameBuffer,
+		// both counted in render commands.
+		std::mutex movedMutex;
+		FrameBuffer movedTarget;
+		uint64_t movedAt;
+		std::atomic<bool> targetMoved;
+		uint64_t targetSetAt;
+		void takeMovedTarget();
+
+		void queueRender(const RenderCommand& cmd);
+		void renderLoop();
+
+		// run the mode state machine forward, drawing lines as they finish
+		void advance(uint32_t cycles);
+		uint32_t cyclesToVBlank() const;
+
+		// cycles into the current line
+		int getDot() const;
+		void getPosition(byte &ly, int &curmode) const;
+
+		byte getSCX() const;
+		byte getSCY() const;
 		
-		byte getLCDC();
-		bool getBGMap();
-		bool getIsLCDOn();
+		byte getLCDC() const;
+		bool getBGMap() const;
+		bool getIsLCDOn() const;
 
-		bool getBGTile();
+		bool getBGTile() const;
 
+		word getTileAddr(bool bank1, word tile, byte y) const;
 		byte getTilePx(bool bank1, word tile, byte y, byte x);
-		Pixel getBGPalColor(byte bg);
+		byte getBGPalShade(byte bg);
+
+		ScanlineRegs getScanlineRegs() const;
+		void renderBackground(const ScanlineRegs& regs, const byte* vram, byte* shades) const;
 
 		void renderScan();
 		void renderScanDebug(VIDEO_DEBUGMODE debug);
 		void renderScanDebugBG(VIDEO_DEBUGMODE debug);
+
+		// convert a line of shades into the frame buffer's format
+		void emitScan(const FrameBuffer& fb, byte ly, const byte* shades);
+		void emitScanGrey(const byte* grey);
+		void refresh();
+		void runFrameHooks(const FrameBuffer& fb);
+
 		vector<RefreshHook> OnRefresh;
+		vector<FrameHook> OnFrame;
+		vector<VBlankHook> OnVBlank;
 	public:
+		// the caller steps the video through updateTimer() after each instruction
 		Video(MMU *mem);
+		// catch-up mode: the video follows cpu->clock and only runs when
+		// something observes it (see sync() and due())
+		Video(Z80 *cpu);
+		~Video();
+
 		void addRefreshHook(RefreshHook hook);
+		void addFrameHook(FrameHook hook);
+		void addVBlankHook(VBlankHook hook);
+
+		// render straight into a caller-owned buffer of at least 144 rows of stride bytes.
+		// takes effect from the next scanline. the buffer must outlive its use.
+		// in threaded mode, frame hooks may call this to pick the next frame's buffer.
+		void setFrameBuffer(void* data, size_t stride, PIXEL_FORMAT format);
+		// go back to the internal rgba canvas
+		void resetFrameBuffer();
+		// in threaded mode, a frame hook's choice shows up here once the render
+		// thread has run it
+		const FrameBuffer& getFrameBuffer();
+
+		// skipped frames still run modes, LY and interrupts as usual,
+		// only pixel generation and the refresh/frame hooks are left out.
+		// decisions are taken at the start of each frame.
+		void setFrameSkip(int n);
+		// with FRAMESKIP_ONDEMAND, draw the next frame that starts.
+		void requestFrame();
+		bool isDrawingFrame() const;
+
+		// reuse last frame's output for lines whose inputs (scroll, palette, map row and
+		// the tiles it points to) didn't change. if the frame buffer stays the same
+		// between frames its rows are assumed to be left alone, and hits skip writing.
+		void setLineCache(bool enabled);
+		LineCacheStats getLineCacheStats() const;
+		void resetLineCacheStats();
+
+		void setDebugMode(VIDEO_DEBUGMODE debug);
+
+		// draw lines on a separate thread. the frame hooks then run on that thread
+		// and the line cache is bypassed. debug views are still drawn here.
+		void setThreaded(bool enabled);
+		bool isThreaded() const;
+		// block until the render thread has drawn everything logged so far
+		void waitForRender();
+
+		// what the cpu would read from LY and STAT right now
+		byte getLY() const;
+		byte getSTAT() const;
+
+		// where the video is in the frame, and what it's decided about it.
+		// pixels, hooks and settings aren't part of it. loading drops the
+		// line cache, and in threaded mode waits for the render thread.
+		void saveState(StateWriter& out) const;
+		void loadState(StateReader& in);
+
+		// in catch-up mode this just syncs
 		void updateTimer(int cpuCycles, Z80 *pr, VIDEO_DEBUGMODE debug = NORMAL);
+
+		// catch-up mode: bring the video up to the cpu clock. register and vram/oam
+		// accesses do this on their own; the run loop only has to call it when due().
+		void sync();
+
+		// has the cpu reached the next thing it can't be late for? (vblank)
+		// never without catch-up mode, where updateTimer() runs the video.
+		bool due() const {
+			return catchup && int32_t(cpu->clock.machine - nextEventAt) >= 0;
+		}
 	};
 }
\ No newline at end of file
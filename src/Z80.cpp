@@ -14,14 +14,46 @@ namespace GBEmu {
 	{
 		pc = 0x0;
 		prevpc = -1;
-		dump = false;
+		trace = nullptr;
+		breakpoints = nullptr;
 		halted = false;
 		stopped = false;
 		interrupts = true;
+		biosRunning = true;
+		profiler = nullptr;
+		callProfiler = nullptr;
 		memset(&clock, 0, sizeof(clock_t));
 		breaknextstep = false;
 	}
 
+	void Z80::skipBIOS()
+	{
+		// what the dmg bootstrap leaves behind
+		static const struct { word addr; byte val; } io[] = {
+			{ 0xFF05, 0x00 }, { 0xFF06, 0x00 }, { 0xFF07, 0x00 },
+			{ 0xFF10, 0x80 }, { 0xFF11, 0xBF }, { 0xFF12, 0xF3 }, { 0xFF14, 0xBF },
+			{ 0xFF16, 0x3F }, { 0xFF17, 0x00 }, { 0xFF19, 0xBF }, { 0xFF1A, 0x7F },
+			{ 0xFF1B, 0xFF }, { 0xFF1C, 0x9F }, { 0xFF1E, 0xBF }, { 0xFF20, 0xFF },
+			{ 0xFF21, 0x00 }, { 0xFF22, 0x00 }, { 0xFF23, 0xBF }, { 0xFF24, 0x77 },
+			{ 0xFF25, 0xF3 }, { 0xFF26, 0xF1 }, { 0xFF40, 0x91 }, { 0xFF42, 0x00 },
+			{ 0xFF43, 0x00 }, { 0xFF45, 0x00 }, { 0xFF47, 0xFC }, { 0xFF48, 0xFF },
+			{ 0xFF49, 0xFF }, { 0xFF4A, 0x00 }, { 0xFF4B, 0x00 }, { 0xFFFF, 0x00 }
+		};
+
+		setAF(0x01B0);
+		setBC(0x0013);
+		setDE(0x00D8);
+		setHL(0x014D);
+		sp = 0xFFFE;
+		pc = 0x100;
+
+		for (auto &r : io)
+			mmu.writeb(r.addr, r.val);
+
+		biosRunning = false;
+		mmu.cleanBIOS();
+	}
+
 	void Z80::setflag(flag_e flag)
 	{
 		f |= flag;
@@ -46,7 +78,7 @@ namespace GBEmu {
 
 	byte Z80::fetchb()
 	{
-		return mmu.readb(pc++);
+		return mmu.fetchb(pc++);
 	}
 
 	byte Z80::getvaluepointedbyHL()
@@ -117,10 +149,40 @@ namespace GBEmu {
 
 	byte Z80::step()
 	{
+		// awaiting an interrupt, time still goes by
+		if (halted) {
+			clock.machine += 4;
+			mmu.stats.add(STAT_HALTED_CYCLES, 4);
+			if (profiler)
+				profiler->recordHalted(4);
+			if (callProfiler)
+				callProfiler->addCycles(callProfiler->getCurrent(), 4);
+			return 4;
+		}
+
+		if (breakpoints && breakpoints->isArmed() && breakpoints->isSet(pc) && breakpoints->check(*this))
+			return 0;
+
+		mmu.stats.add(STAT_INSTRUCTIONS);
+
+		if (trace && trace->sample(pc, mmu.getROMBank()))
+			traceInstruction();
+
 		prevpc = pc;
+		// the bank as it was before the instruction gets to switch it
+		word bank = profiler ? mmu.getROMBank() : 0;
+		uint32_t before = clock.machine;
+		// a call's own cycles belong to the caller, a return's to the callee
+		uint32_t context = callProfiler ? callProfiler->getCurrent() : 0;
+
 		byte opc = fetchb();
 		auto rt = runopcode(opc);
 
+		if (profiler)
+			profiler->record(bank, prevpc, clock.machine - before);
+		if (callProfiler)
+			callProfiler->addCycles(context, clock.machine - before);
+
 		// done with the bios!
 		if (biosRunning && pc == 0x100) {
 			biosRunning = false;
@@ -138,28 +200,40 @@ namespace GBEmu {
 		bool interruptRan = false;
 		// addresses 0x40, 0x48, 0x50, 0x58 and 0x60 are interrupt addresses.
 
-		byte interrupts = mmu.readb(0xFF0F);
+		// the hardware asking, so nothing a hook, watch or coverage should see
+		byte interrupts = mmu.rawreadb(0xFF0F);
 		interrupts |= 1 << intr;
-		mmu.writeb(0xFF0F, interrupts);
+		mmu.rawwriteb(0xFF0F, interrupts);
 	}
 
 	void Z80::callint(word addr)
 	{
-		mmu.writew(sp, pc);
 		sp -= 2;
+		mmu.writew(sp, pc);
 		pc = addr;
 
+		// taking it clears its request
+		mmu.rawwriteb(0xFF0F, mmu.rawreadb(0xFF0F) & ~(1 << ((addr - 0x40) >> 3)));
+
+		if (callProfiler)
+			callProfiler->onCall(mmu.getROMBank(), addr, sp, true);
+
 		interrupts = false;
 		clock.machine += 5;
 	}
 
 	void Z80::executeinterrupts()
 	{
+		// checked between every instruction, the program didn't read these
+		byte enabledinterrupts = mmu.rawreadb(0xFFFF);
+		byte requests = mmu.rawreadb(0xFF0F);
+
+		// a pending interrupt ends a halt, even with interrupts disabled
+		if (requests & enabledinterrupts & 0x1F)
+			halted = false;
+
 		if (!interrupts) // they're disabled. don't process them.
 			return;
-
-		byte enabledinterrupts = mmu.readb(0xFFFF);
-		byte requests = mmu.readb(0xFF0F);
 		if (requests & (1 << int_vblank) && enabledinterrupts & (1 << int_vblank))
 		{
 			callint(0x40);
@@ -215,27 +289,6 @@ namespace GBEmu {
 				return 0;
 			}
 
-			if (dump && opc != 0xCB && opc != 0) // skip nops
-			{
-				std::string desc = ops[opc].desc;
-				int i;
-				if ((i = desc.find_first_of("n")) != std::string::npos) {
-					char buf[8];
-					sprintf(buf, "$%02x", mmu.readb(pc));
-					desc.replace(i, 1, buf);
-				}
-
-				if ((i = desc.find_first_of("w")) != std::string::npos) {
-					char buf[8];
-					sprintf(buf, "$%04x", mmu.readw(pc));
-					desc.replace(i, 1, buf);
-				}
-
-				disassembly[pc] = desc;
-
-				printf("%04x: %s\n", pc, desc.c_str());
-			}
-
 			byte c = ops[opc].op(this);
 			clock.machine += c;
 			return c;
@@ -248,10 +301,6 @@ namespace GBEmu {
 			}
 
 			byte c = optable2[opc & 0xFF].op(this);
-			if (dump) 
-			{
-				std::clog << "0x" << std::hex << prevpc << ": " << optable2[opc & 0xFF].desc << std::endl;
-			}
 			return c;
 		}
 
@@ -266,11 +315,76 @@ namespace GBEmu {
 		return 1. / frequency * 1000.0;
 	}
 
-	void Z80::dumpins()
+	void Z80::saveState(StateWriter& out) const
 	{
-		for (auto v : disassembly)
-		{
-			std::clog << v.second;
-		}
+		saveRegisters(out);
+		mmu.saveState(out);
+	}
+
+	void Z80::loadState(StateReader& in)
+	{
+		loadRegisters(in);
+		mmu.loadState(in);
+	}
+
+	void Z80::forkFrom(Z80& parent)
+	{
+		byte regs[64];
+		StateWriter out(regs, sizeof(regs));
+		parent.saveRegisters(out);
+		StateReader in(regs, out.getSize());
+		loadRegisters(in);
+
+		mmu.forkFrom(parent.mmu);
+	}
+
+	void Z80::saveRegisters(StateWriter& out) const
+	{
+		byte regs[] = { a, b, c, d, e, h, l, f };
+		out.put(regs);
+		out.put(pc);
+		out.put(prevpc);
+		out.put(sp);
+		out.put(interrupts);
+		out.put(halted);
+		out.put(stopped);
+		out.put(biosRunning);
+		out.put(clock.machine);
+	}
+
+	void Z80::loadRegisters(StateReader& in)
+	{
+		byte regs[8];
+		in.get(regs);
+		a = regs[0]; b = regs[1]; c = regs[2]; d = regs[3];
+		e = regs[4]; h = regs[5]; l = regs[6]; f = regs[7];
+		in.get(pc);
+		in.get(prevpc);
+		in.get(sp);
+		in.get(interrupts);
+		in.get(halted);
+		in.get(stopped);
+		in.get(biosRunning);
+		in.get(clock.machine);
+	}
+
+	void Z80::traceInstruction()
+	{
+		TraceRecord rec;
+		rec.cycle = clock.machine;
+		rec.bank = mmu.getROMBank();
+		rec.pc = pc;
+		rec.sp = sp;
+		rec.a = a; rec.f = f;
+		rec.b = b; rec.c = c;
+		rec.d = d; rec.e = e;
+		rec.h = h; rec.l = l;
+		rec.op[0] = mmu.peekb(pc);
+		rec.op[1] = mmu.peekb(pc + 1);
+		rec.op[2] = mmu.peekb(pc + 2);
+		rec.flags = 0;
+		rec.reserved[0] = rec.reserved[1] = 0;
+
+		trace->record(rec);
 	}
-}
\ No newline at end of file
+}
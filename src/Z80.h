@@ -3,6 +3,10 @@
 
 #include "types.h"
 #include "MMU.h"
+#include "Profiler.h"
+#include "CallProfiler.h"
+#include "ExecTrace.h"
+#include "Breakpoints.h"
 #include <map>
 
 namespace GBEmu {
@@ -80,8 +84,11 @@ namespace GBEmu {
 		// stack pointer
 		word sp;
 
-		// do dump
-		bool dump;
+		// when set, executed instructions are recorded in here
+		ExecTrace* trace;
+
+		// when set and armed, step() stops before a breakpoint and returns 0
+		Breakpoints* breakpoints;
 
 		// do we return false next step?
 		bool breaknextstep;
@@ -98,6 +105,12 @@ namespace GBEmu {
 		// bios is running
 		bool biosRunning;
 
+		// when set, every instruction's cycles are counted in here
+		Profiler* profiler;
+
+		// when set, calls and returns are followed and cycles go to the calling context
+		CallProfiler* callProfiler;
+
 		// the point of this structure is to use the accomulation of cycles to know
 		// how long to wait.
 		struct clock_t {
@@ -130,10 +143,30 @@ namespace GBEmu {
 		// system components
 		MMU mmu;
 
-		std::map<word, std::string> disassembly;
 		Z80();
 
+		// start at 0x100 with the registers and io the bios would've left
+		void skipBIOS();
+
 		double msPerCycle();
-		void dumpins();
+
+		// registers and clock, then the mmu's
+		void saveState(StateWriter& out) const;
+		void loadState(StateReader& in);
+
+		// become a copy of parent, see MMU::forkFrom. what's attached
+		// (profilers, trace, breakpoints) stays our own.
+		void forkFrom(Z80& parent);
+
+	private:
+		void traceInstruction();
+		void saveRegisters(StateWriter& out) const;
+		void loadRegisters(StateReader& in);
 	};
+
+	// the handlers, by opcode. optable2 has the ones behind the 0xCB prefix.
+	extern Z80::z80op ops[256];
+	extern Z80::z80op optable2[256];
+	// what unimplemented opcodes point at
+	byte ILLOP(Z80* pr);
 }
\ No newline at end of file
@@ -1,6 +1,9 @@
 #include "Z80.h"
 #include "ROM.h"
 #include "Video.h"
+#include "ReverseDebugger.h"
+#include "Disassembler.h"
+#include "SaveState.h"
 #include <iostream>
 #include <fstream>
 #include <iomanip>
@@ -9,7 +12,7 @@
 
 GBEmu::Z80 cpu;
 GBEmu::ROM rom;
-GBEmu::Video vid(&cpu.mmu);
+GBEmu::Video vid(&cpu);
 bool locked = false;
 
 void sigbreak(int sig)
@@ -49,6 +52,14 @@ void print16regs(GBEmu::Z80 &cpu)
 {
 	int op;
 	std::string cmd;
+	GBEmu::ExecTrace trace;
+	GBEmu::Breakpoints breakpoints;
+	cpu.breakpoints = &breakpoints;
+	// labels for breakpoints, traces and listings, from the sym command
+	vector<std::string> symFiles;
+	std::shared_ptr<const GBEmu::SymbolTable> symbols;
+	// steps go through here so they can be taken back
+	GBEmu::ReverseDebugger history(&cpu, &vid, nullptr);
 	std::cout << std::right << std::setfill('0');
 
 	std::cout << "yagbemu's gbz80 debugger interface start.\n";
@@ -77,11 +88,11 @@ void print16regs(GBEmu::Z80 &cpu)
 		}
 		else if (cmd == "step" || cmd == "s")
 		{
-			vid.updateTimer(cpu.step(), &cpu); 
+			history.step();
 		}
 		else if (cmd == "stepandinfo" || cmd == "si")
 		{
-			vid.updateTimer(cpu.step(), &cpu); 
+			history.step();
 			
 			printregs(cpu); print16regs(cpu);
 		}
@@ -113,6 +124,7 @@ void print16regs(GBEmu::Z80 &cpu)
 				cpu.sp = w;
 			if (rg == "pc")
 				cpu.pc = w;
+			history.reset(); // can't be replayed into
 		}
 		else if (cmd == "printw") {
 			short addr; std::cin >> addr;
@@ -128,11 +140,13 @@ void print16regs(GBEmu::Z80 &cpu)
 			short addr; std::cin >> addr;
 			byte b; std::cin >> b;
 			cpu.mmu.writeb(addr, b);
+			history.reset();
 		}
 		else if (cmd == "setw") {
 			short addr; std::cin >> addr;
 			word b; std::cin >> b;
 			cpu.mmu.writew(addr, b);
+			history.reset();
 		}
 		else if (cmd == "ldrom" || cmd == "ld")
 		{
@@ -141,44 +155,74 @@ void print16regs(GBEmu::Z80 &cpu)
 
 			rom.loadfromfile(fn.c_str());
 			cpu.mmu.assignrom(&rom);
+			history.reset();
 
 			std::cout << "loaded rom " << rom.gettitle() << std::endl;
+		}
+		else if (cmd == "savestate")
+		{
+			std::string fn; std::getline(std::cin, fn);
+			GBEmu::saveStateFile(cpu, vid, nullptr, fn.substr(1));
+		}
+		else if (cmd == "loadstate")
+		{
+			std::string fn; std::getline(std::cin, fn);
+			GBEmu::loadStateFile(cpu, vid, nullptr, fn.substr(1));
+			history.reset();
+			printregs(cpu); print16regs(cpu);
 		} else if (cmd == "c" || cmd == "continue")
 		{
 			locked = true;
-			byte c = 0;
-			while (c = cpu.step()) { vid.updateTimer(c, &cpu); }
+			history.run(UINT64_MAX);
 			locked = false;
+
+			if (breakpoints.isStopped(cpu)) std::cout << "breakpoint " << breakpoints.getLastHit()->id << " hit" << (symbols ? " at " + symbols->format(cpu.mmu.getROMBank(), cpu.pc) : "") << std::endl;
+		} else if (cmd == "reversestep" || cmd == "rs")
+		{
+			if (!history.stepBack()) std::cout << "no history that far back" << std::endl;
+			printregs(cpu); print16regs(cpu);
+		} else if (cmd == "reversecontinue" || cmd == "rc")
+		{
+			if (!history.continueBack()) std::cout << "no breakpoint in the history, at the oldest point" << std::endl;
+			else std::cout << "breakpoint " << breakpoints.match(cpu)->id << " hit" << std::endl;
 		} else if (cmd == "q")
 			return 0;
 		else if (cmd == "sd" || cmd == "setdump")
-			cpu.dump = true;
+			cpu.trace = &trace;
 		else if (cmd == "cd" || cmd == "cleardump") 
-			cpu.dump = false;
+			cpu.trace = nullptr;
 		else if (cmd == "trace")
-			cpu.dumpins();
+		{
+			for (auto &r : trace.getRecords())
+				std::clog << GBEmu::ExecTrace::formatRecord(r, symbols.get()) << "\n";
+		}
 		else if (cmd == "breakpoint" || cmd == "b")
 		{
-			int bp; std::cin >> bp;
-			
-			locked = true;
-			while (cpu.pc != bp)
-			{
-				byte c;
-				if (! (c = cpu.step()) ) break;
-				vid.updateTimer(c, &cpu);
-			}
-			locked = false;
+			// "[bank:]addr [if condition]" or "label [if condition]", see Breakpoints.h. c runs to it.
+			std::string spec; std::getline(std::cin, spec);
+			std::cout << "breakpoint " << breakpoints.add(spec.substr(1)) << std::endl;
+		}
+		else if (cmd == "sym")
+		{
+			std::string fn; std::getline(std::cin, fn);
+			symFiles.push_back(fn.substr(1));
+			symbols = GBEmu::SymbolTable::loadShared(symFiles);
+			breakpoints.setSymbols(symbols);
 
-			if (bp == cpu.pc) std::cout << "breakpoint hit" << std::endl;
+			std::cout << symbols->size() << " labels" << std::endl;
+		}
+		else if (cmd == "delete")
+		{
+			int id; std::cin >> id;
+			if (!breakpoints.remove(id)) std::cout << "no such breakpoint" << std::endl;
 		}
 		else if (cmd == "disassemble")
 		{
 			std::cout << "writing to dis.txt\n";
 			std::fstream out("dis.txt", std::ios::out);
-			for (auto v : cpu.disassembly) {
-				out << v.second << "\n";
-			}
+			GBEmu::CodeIndex index;
+			index.build(rom);
+			index.exportListing(rom, out, symbols.get());
 		}
 		else std::cout << "unknown command\n";
 		
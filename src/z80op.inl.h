@@ -520,6 +520,8 @@ OP(SWAP) {
 		word pushaddr = pr->pc; // call + return address
 		pr->sp -= 2; pr->mmu.writew(pr->sp, pushaddr);
 		pr->pc = jmpaddr; // holy cow, subroutines
+		if (pr->callProfiler)
+			pr->callProfiler->onCall(pr->mmu.getROMBank(), jmpaddr, pr->sp, false);
 		return 12;
 	}
 
@@ -548,8 +550,10 @@ OP(SWAP) {
 	}
 
 	void RSTgen(GBEmu::Z80 *pr, word jmpaddr) {
-		pr->mmu.writew(pr->sp, pr->pc - 1); pr->sp -= 2;
+		pr->sp -= 2; pr->mmu.writew(pr->sp, pr->pc); // same as CALL
 		pr->pc = jmpaddr;
+		if (pr->callProfiler)
+			pr->callProfiler->onCall(pr->mmu.getROMBank(), jmpaddr, pr->sp, false);
 	}
 
 	OP(RST00) {
@@ -585,6 +589,8 @@ OP(SWAP) {
 	}
 
 	OP(RET) {
+		if (pr->callProfiler)
+			pr->callProfiler->onReturn(pr->sp);
 		word jmpaddr = pr->mmu.readw(pr->sp);
 		pr->sp += 2;
 		pr->pc = jmpaddr; // WOW we're BACK to the previous routine. So cool!